@@ -1,14 +1,18 @@
 #version 330 core
 
-// Interpolated values from the vertex shaders
+// Interpolated values from the vertex shaders, constant over solid colour meshes
+#ifdef VERTEX_COLOR
 in vec3 fragColor;
+#else
+flat in vec3 fragColor;
+#endif
 
 // output data
-out vec3 color;
+out vec4 color;
 
 void main()
 {
     // Output color = color specified in the vertex shader,
     // interpolated between all 3 surrounding vertices of the triangle
-    color = fragColor;
+    color = vec4(fragColor, 1.0);
 }
@@ -1,22 +1,59 @@
 #version 330 core
 
+// Variant features, defined by the renderer for each program it builds from this file :
+// VERTEX_COLOR : colour per vertex, multiplied by the object's colour
+// INSTANCED    : vertices placed by their object's matrix in Objects, else already in world space
+
 // input data : sent from main program
-layout (location = 0) in vec3 vertexPosition;
-layout (location = 1) in vec3 vertexColor;
+layout (location = 0) in vec2 vertexPosition;
+#ifdef VERTEX_COLOR
+layout (location = 1) in vec4 vertexColor;
+#endif
+
+#ifdef INSTANCED
+// per-instance data : slot of this instance in Objects, streamed only for
+// instanced draws, other draws get the generic value set by the renderer
+layout (location = 2) in int instanceObject;
+
+// model matrix columns then colour, 5 texels per object
+uniform samplerBuffer Objects;
+#endif
 
-uniform mat4 MVP;
+// shared by every program, uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
 
 // output data : used by fragment shader
+#ifdef VERTEX_COLOR
 out vec3 fragColor;
+#else
+flat out vec3 fragColor;
+#endif
 
 void main ()
 {
-    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+    vec4 v = vec4(vertexPosition, 0, 1); // Transform an homogeneous 4D vector
 
+#ifdef INSTANCED
+    int object = instanceObject * 5;
+    mat4 model = mat4(texelFetch(Objects, object),
+                      texelFetch(Objects, object + 1),
+                      texelFetch(Objects, object + 2),
+                      texelFetch(Objects, object + 3));
+    vec3 color = texelFetch(Objects, object + 4).rgb;
+
+    // Output position of the vertex, in clip space : VP * model * position
+    gl_Position = VP * model * v;
+#else
+    vec3 color = vec3(1.0);
+    gl_Position = VP * v;
+#endif
+
+#ifdef VERTEX_COLOR
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
-    fragColor = vertexColor;
-
-    // Output position of the vertex, in clip space : MVP * position
-    gl_Position = MVP * v;
+    color *= vertexColor.rgb;
+#endif
+    fragColor = color;
 }
@@ -3,10 +3,25 @@
 #include <fstream>
 #include <vector>
 #include <cstring>
-#include <glad/glad.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+#include <algorithm>
+#include <charconv>
+#include <thread>
+#include <chrono>
+#include "glloader.h"      // generated by make from glfunctions.txt
+#define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 
-#include <FTGL/ftgl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fontatlas.h"
+#include "shaders.h"      // generated by make from the .vert and .frag files
 
 #include <SOIL/SOIL.h>
 #define GLM_FORCE_RADIANS
@@ -20,107 +35,466 @@ using namespace std;
 
 
 
+/* Axis aligned rectangle in the xy plane */
+struct Bounds {
+    float MinX, MinY, MaxX, MaxY;
+};
+
+/* Handle to a mesh sub-allocated from the shared MeshBuffer */
 struct VAO {
-    GLuint VertexArrayID;
-    GLuint VertexBuffer;
-    GLuint ColorBuffer;
+    int FirstIndex;  // first index of the mesh in MeshBuffer
+    int NumIndices;
+    int BaseVertex;  // added to the mesh's indices, which start at 0 for every mesh
 
     GLenum PrimitiveMode;
     GLenum FillMode;
-    int NumVertices;
+    int NumVertices; // distinct vertices stored from BaseVertex
+    Bounds Extent;   // of the vertices, in the mesh's own space
+    bool Solid;      // of one colour : stored white, Color goes to its objects instead
+    glm::vec3 Color; // white unless Solid
 };
 typedef struct VAO VAO;
 
+/* Compact vertex : 2D half float position and normalized byte colour, 8 bytes */
+/* The scene is flat, so z is always 0 and is not stored */
+struct MeshVertex {
+    GLhalf x, y;
+    GLubyte r, g, b, a;
+};
+
+/* Every static mesh lives in one vertex buffer and one index buffer drawn through one VAO */
+/* so switching between meshes only changes the offsets of the draw call */
+struct MeshBuffer {
+    GLuint VertexArrayID;
+    GLuint VertexBuffer;
+    GLuint IndexBuffer;
+    std::vector<MeshVertex> Vertices;
+    std::vector<glm::vec2> Positions; // full precision copy of the vertex positions, for the CPU
+    std::vector<GLushort> Indices;
+    int UploadedIndices;           // how much of Indices is already in IndexBuffer
+    bool InstanceArrays;           // instance attribute 2 enabled
+} Meshes;
+
 struct GLMatrices {
 	glm::mat4 projection;
 	glm::mat4 model;
 	glm::mat4 view;
-	GLuint MatrixID;
 } Matrices;
 
-struct FTGLFont {
-	FTFont* font;
-	GLuint fontMatrixID;
+struct TextFont {
+	GlyphInfo Glyphs[GLYPH_COUNT];
+	GLuint texture;
 	GLuint fontColorID;
-} GL3Font;
+} Font;
 
-GLuint programID, fontProgramID, textureProgramID;
+GLuint fontProgramID, textureProgramID, circleProgramID;
 
+/* Optional parts of Sample_GL.vert and Sample_GL.frag, each one compiled in by its define */
+enum SceneFeature {
+	FEATURE_VERTEX_COLOR = 1, // colour from the mesh's vertices
+	FEATURE_INSTANCED = 2,    // model and colour fetched from the "Objects" buffer by slot
+};
+const int SCENE_FEATURE_COUNT = 2;
+const char* SceneFeatureDefines[SCENE_FEATURE_COUNT] = { "#define VERTEX_COLOR\n", "#define INSTANCED\n" };
+
+/* Linked variants of the scene program by their feature mask, 0 until built */
+GLuint SceneVariants[1 << SCENE_FEATURE_COUNT];
+
+/* Shadow copy of the GL state set by the renderer */
+/* Every state change goes through it so changes already in effect are never sent to GL */
+struct GLStateCache {
+	GLuint Program;
+	GLuint VertexArray;
+	GLuint ArrayBuffer;
+	GLenum PolygonMode;
+	int Blend;     // -1 when unknown
+
+	// Counters since the last stats report
+	int Issued;    // state changes passed on to GL
+	int Skipped;   // state changes dropped because they were already in effect
+	int DrawCalls;
+	int Frames;
+	int Transforms;     // world matrices recomputed by the scene graph
+	int Culled;         // draws dropped outside the view
+	int Idle;           // frames not drawn because nothing on screen changed
+	double RecordTime;  // seconds spent recording draw commands
+	double SubmitTime;  // seconds spent submitting them to GL
+} GLState;
+
+/* Scene resolution, adapted every frame to hold the frame time when fill rate bound */
+struct ResolutionScaler {
+	float Scale;            // of the framebuffer size, between MinScale and MaxScale
+	float MinScale, MaxScale;
+	double TargetTime;      // seconds of GL time per frame
+	double FrameTime;       // last measured
+	GLuint Queries[2];      // GL_TIME_ELAPSED of alternate frames, each read back a frame later
+	bool Pending[2];
+	int Current;
+} Resolution = {1, 0.5f, 1, 1/60.0, 0, {0, 0}, {false, false}, 0};
+
+/* Forget the cached state, for use after code outside the tracker has touched GL */
+void invalidateGLState ()
+{
+	GLState.Program = (GLuint)-1;
+	GLState.VertexArray = (GLuint)-1;
+	GLState.ArrayBuffer = (GLuint)-1;
+	GLState.PolygonMode = GL_NONE;
+	GLState.Blend = -1;
+}
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+void useProgram (GLuint program)
+{
+	if (GLState.Program == program) {
+		GLState.Skipped++;
+		return;
+	}
+	glUseProgram (program);
+	GLState.Program = program;
+	GLState.Issued++;
+}
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+void bindVertexArray (GLuint vertexArray)
+{
+	if (GLState.VertexArray == vertexArray) {
+		GLState.Skipped++;
+		return;
+	}
+	glBindVertexArray (vertexArray);
+	GLState.VertexArray = vertexArray;
+	GLState.Issued++;
+}
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open())
-	{
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
+void bindArrayBuffer (GLuint buffer)
+{
+	if (GLState.ArrayBuffer == buffer) {
+		GLState.Skipped++;
+		return;
+	}
+	glBindBuffer (GL_ARRAY_BUFFER, buffer);
+	GLState.ArrayBuffer = buffer;
+	GLState.Issued++;
+}
+
+void setPolygonMode (GLenum mode)
+{
+	if (GLState.PolygonMode == mode) {
+		GLState.Skipped++;
+		return;
+	}
+	glPolygonMode (GL_FRONT_AND_BACK, mode);
+	GLState.PolygonMode = mode;
+	GLState.Issued++;
+}
+
+void setBlend (bool enabled)
+{
+	if (GLState.Blend == (int)enabled) {
+		GLState.Skipped++;
+		return;
+	}
+	if (enabled)
+		glEnable (GL_BLEND);
+	else
+		glDisable (GL_BLEND);
+	GLState.Blend = enabled;
+	GLState.Issued++;
+}
+
+void resetRenderStats ()
+{
+	GLState.Issued = GLState.Skipped = GLState.DrawCalls = GLState.Frames = GLState.Transforms = GLState.Culled = GLState.Idle = 0;
+	GLState.RecordTime = GLState.SubmitTime = 0;
+}
+
+void printRenderStats ()
+{
+	int frames = max(GLState.Frames, 1);
+	cout << "fps: " << GLState.Frames
+	     << "  draws/frame: " << GLState.DrawCalls/frames
+	     << "  state changes/frame: " << GLState.Issued/frames
+	     << "  skipped/frame: " << GLState.Skipped/frames
+	     << "  record ms: " << GLState.RecordTime*1000/frames
+	     << "  submit ms: " << GLState.SubmitTime*1000/frames
+	     << "  transforms/frame: " << GLState.Transforms/frames
+	     << "  culled/frame: " << GLState.Culled/frames
+	     << "  gl ms: " << Resolution.FrameTime*1000
+	     << "  scale: " << Resolution.Scale
+	     << "  idle: " << GLState.Idle << endl;
+	resetRenderStats();
+}
+
+
+/* 64-bit FNV-1a hash, chained through hash for hashing several blocks */
+uint64_t hashBytes (const void* data, size_t size, uint64_t hash=14695981039346656037ULL)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i=0; i<size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Text of a shader, not null terminated */
+struct ShaderSource {
+	const char* Text;
+	GLint Length;
+	std::string File;   // holds Text when read from $SHADER_DIR
+};
+
+/* Find a shader by file name : in the directory named by $SHADER_DIR if set, for editing */
+/* shaders without rebuilding, else in the copies built into the executable */
+void findShader (const char* name, ShaderSource& shader)
+{
+	shader.Text = NULL;
+	shader.Length = 0;
+	const char* directory = getenv("SHADER_DIR");
+	if (directory) {
+		// The whole file in one read
+		std::string path = std::string(directory) + "/" + name;
+		int fd = open(path.c_str(), O_RDONLY);
+		struct stat info;
+		if (fd >= 0 && fstat(fd, &info) == 0) {
+			shader.File.resize(info.st_size);
+			if (read(fd, &shader.File[0], info.st_size) == info.st_size) {
+				shader.Text = shader.File.data();
+				shader.Length = info.st_size;
+			}
+		}
+		if (fd >= 0)
+			close(fd);
+		if (shader.Text)
+			return;
+		cout << "Shader `" << path << "' unreadable, using the built in copy" << endl;
 	}
+	for (const EmbeddedShader& embedded : EmbeddedShaders)
+		if (strcmp(embedded.Name, name) == 0) {
+			shader.Text = embedded.Source;
+			shader.Length = embedded.Length;
+			return;
+		}
+	cout << "Error: no shader named `" << name << "'" << endl;
+	shader.Text = "";
+}
+
+/* Linked programs are kept in the user's cache directory, one file per program named by its key */
+/* $XDG_CACHE_HOME/sample2D or ~/.cache/sample2D, empty when neither is known and nothing is cached */
+std::string shaderCacheDirectory ()
+{
+	const char* cache = getenv("XDG_CACHE_HOME");
+	if (cache && cache[0] == '/')
+		return std::string(cache) + "/sample2D";
+	const char* home = getenv("HOME");
+	if (home && home[0] == '/')
+		return std::string(home) + "/.cache/sample2D";
+	return "";
+}
+
+struct ProgramBinaryHeader {
+	char Magic[4];      // "PBIN"
+	uint32_t Format;    // as returned by glGetProgramBinary
+	uint32_t Length;    // bytes of binary following the header
+	uint64_t Key;
+};
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+/* Key of a program : its sources and the driver that compiles them, whose binaries are only valid for itself */
+uint64_t programKey (const ShaderSource& vertex, const ShaderSource& fragment, const char* defines)
+{
+	uint64_t hash = hashBytes(vertex.Text, vertex.Length);
+	hash = hashBytes(fragment.Text, fragment.Length, hash);
+	hash = hashBytes(defines, strlen(defines), hash);
+	GLenum strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+	for (GLenum name : strings) {
+		const char* value = (const char*)glGetString(name);
+		hash = hashBytes(value, value ? strlen(value) + 1 : 0, hash);
 	}
+	return hash;
+}
+
+bool programBinariesSupported ()
+{
+	GLint formats = 0;
+	if (GLExtension.ARB_get_program_binary)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+std::string programCachePath (const std::string& directory, uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+	return directory + name;
+}
+
+/* Restore the program saved under key, 0 if there is none or the driver rejects it */
+GLuint loadProgramBinary (uint64_t key)
+{
+	std::string directory = shaderCacheDirectory();
+	if (directory.empty())
+		return 0;
+	std::ifstream stream(programCachePath(directory, key).c_str(), std::ios::in | std::ios::binary);
+	ProgramBinaryHeader header;
+	if (!stream.read((char*)&header, sizeof(header)) || memcmp(header.Magic, "PBIN", 4) != 0 || header.Key != key)
+		return 0;
+	std::vector<char> binary(header.Length);
+	if (!stream.read(binary.data(), binary.size()))
+		return 0;
 
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, header.Format, binary.data(), binary.size());
 	GLint Result = GL_FALSE;
-	int InfoLogLength;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if (Result != GL_TRUE) {
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	return ProgramID;
+}
+
+/* Save a linked program under key, written aside then renamed so readers never see part of it */
+void saveProgramBinary (GLuint ProgramID, uint64_t key)
+{
+	std::string directory = shaderCacheDirectory();
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (directory.empty() || length <= 0)
+		return;
+	std::vector<char> binary(length);
+	GLenum format;
+	glGetProgramBinary(ProgramID, length, &length, &format, binary.data());
+	ProgramBinaryHeader header = {{'P', 'B', 'I', 'N'}, format, (uint32_t)length, key};
+
+	// Create the directory and any missing parent, ~/.cache itself may not exist yet
+	for (size_t slash = directory.find('/', 1); ; slash = directory.find('/', slash + 1)) {
+		mkdir(directory.substr(0, slash).c_str(), 0755);
+		if (slash == std::string::npos)
+			break;
+	}
+	std::string path = programCachePath(directory, key), temporary = path + ".tmp";
+	std::ofstream stream(temporary.c_str(), std::ios::out | std::ios::binary);
+	stream.write((const char*)&header, sizeof(header));
+	stream.write(binary.data(), length);
+	stream.close();
+	if (stream)
+		rename(temporary.c_str(), path.c_str());
+	else
+		remove(temporary.c_str());
+}
+
+/* Split a shader after its #version line so defines can be compiled in after it */
+void shaderStrings (const ShaderSource& shader, const char* defines, const GLchar* strings[3], GLint lengths[3])
+{
+	const char* end = (const char*)memchr(shader.Text, '\n', shader.Length);
+	GLint version = end ? end + 1 - shader.Text : shader.Length;
+	strings[0] = shader.Text;
+	lengths[0] = version;
+	strings[1] = defines;
+	lengths[1] = strlen(defines);
+	strings[2] = shader.Text + version;
+	lengths[2] = shader.Length - version;
+}
+
+/* A program handed to the driver by beginProgram and not yet checked */
+/* Nothing waits on the compiler until finishProgram, so programs begun together can compile together */
+struct ProgramBuild {
+	const char* VertexName;
+	const char* FragmentName;
+	GLuint ProgramID;
+	GLuint VertexShaderID, FragmentShaderID;   // 0 when the program came from the cache
+	uint64_t Key;
+	bool Cacheable;
+};
+
+/* defines, "#define NAME" lines, are compiled in at the start of both shaders to build a variant of them */
+void beginProgram (ProgramBuild& build, const char * vertex_file_path, const char * fragment_file_path, const char* defines="")
+{
+	build.VertexName = vertex_file_path;
+	build.FragmentName = fragment_file_path;
+	build.VertexShaderID = build.FragmentShaderID = 0;
+
+	// Find the Vertex and Fragment Shader code, built in or from $SHADER_DIR
+	ShaderSource VertexShaderCode, FragmentShaderCode;
+	findShader(vertex_file_path, VertexShaderCode);
+	findShader(fragment_file_path, FragmentShaderCode);
+
+	// Reuse the program linked by an earlier run, if the sources and driver are the same
+	build.Cacheable = programBinariesSupported();
+	build.Key = programKey(VertexShaderCode, FragmentShaderCode, defines);
+	if (build.Cacheable) {
+		build.ProgramID = loadProgramBinary(build.Key);
+		if (build.ProgramID)
+			return;
+	}
+
+	// Create and compile the shaders
+	const GLchar* strings[3];
+	GLint lengths[3];
+	build.VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	shaderStrings(VertexShaderCode, defines, strings, lengths);
+	glShaderSource(build.VertexShaderID, 3, strings, lengths);
+	glCompileShader(build.VertexShaderID);
+
+	build.FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+	shaderStrings(FragmentShaderCode, defines, strings, lengths);
+	glShaderSource(build.FragmentShaderID, 3, strings, lengths);
+	glCompileShader(build.FragmentShaderID);
 
-	// Compile Vertex Shader
-	cout << "Compiling shader : " <<  vertex_file_path << endl;
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
+	// Link the program
+	build.ProgramID = glCreateProgram();
+	glAttachShader(build.ProgramID, build.VertexShaderID);
+	glAttachShader(build.ProgramID, build.FragmentShaderID);
+	if (build.Cacheable)
+		glProgramParameteri(build.ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(build.ProgramID);
+}
+
+/* Wait for the program, print its logs and cache it if it linked */
+GLuint finishProgram (ProgramBuild& build)
+{
+	if (build.VertexShaderID == 0) {
+		cout << "Loaded program from cache : " << build.VertexName << ", " << build.FragmentName << endl;
+		return build.ProgramID;
+	}
+
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
 
 	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	cout << "Compiling shader : " << build.VertexName << endl;
+	glGetShaderiv(build.VertexShaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(build.VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
 	std::vector<char> VertexShaderErrorMessage( max(InfoLogLength, int(1)) );
-	glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
+	glGetShaderInfoLog(build.VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
 	cout << VertexShaderErrorMessage.data() << endl;
 
-	// Compile Fragment Shader
-	cout << "Compiling shader : " << fragment_file_path << endl;
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
-
 	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	cout << "Compiling shader : " << build.FragmentName << endl;
+	glGetShaderiv(build.FragmentShaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(build.FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
 	std::vector<char> FragmentShaderErrorMessage( max(InfoLogLength, int(1)) );
-	glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
+	glGetShaderInfoLog(build.FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
 	cout << FragmentShaderErrorMessage.data() << endl;
 
-	// Link the program
-	cout << "Linking program" << endl;
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
-
 	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	cout << "Linking program" << endl;
+	glGetProgramiv(build.ProgramID, GL_LINK_STATUS, &Result);
+	glGetProgramiv(build.ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
 	std::vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
-	glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+	glGetProgramInfoLog(build.ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 	cout << ProgramErrorMessage.data() << endl;
+	if (build.Cacheable && Result == GL_TRUE)
+		saveProgramBinary(build.ProgramID, build.Key);
 
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	glDeleteShader(build.VertexShaderID);
+	glDeleteShader(build.FragmentShaderID);
 
-	return ProgramID;
+	return build.ProgramID;
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+	ProgramBuild build;
+	beginProgram(build, vertex_file_path, fragment_file_path);
+	return finishProgram(build);
 }
 
 void reshapeWindow (GLFWwindow* window, int width, int height);
@@ -139,103 +513,1113 @@ void quit(GLFWwindow *window)
 }
 
 
-/* Generate VAO, VBOs and return VAO handle */
+/* Convert a float to an IEEE 754 half float, rounding to nearest */
+GLhalf floatToHalf (float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent >= 31) // too large, clamp to infinity
+        return sign | 0x7c00;
+    if (exponent <= 0) { // subnormal half, or zero
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1)
+            half++;
+        return sign | half;
+    }
+
+    uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000) // a carry into the exponent is still the right rounding
+        half++;
+    return half;
+}
+
+/* Meshes uploaded so far, keyed by a hash of their contents */
+/* The geometry is kept to tell hash collisions apart from real duplicates */
+struct MeshEntry {
+    struct VAO* vao;
+    std::vector<GLfloat> vertices;
+    std::vector<GLfloat> colors;
+};
+std::unordered_multimap<uint64_t, MeshEntry> MeshRegistry;
+int MeshRequests = 0;
+
+/* Handles of the solid meshes of other colours than white, keyed by their white mesh */
+std::unordered_multimap<const struct VAO*, struct VAO*> MeshTints;
+
+/* Add the mesh to the shared mesh buffer and return its handle */
+/* Identical geometry is stored once, later requests share the same handle */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
 {
+    // A mesh of one colour is stored white and takes its colour from its objects, so it shares its
+    // vertices with the other meshes of its shape, and its draws need no vertex colours
+    bool solid = true;
+    for (int i=1; i<numVertices && solid; i++)
+        solid = memcmp(&color_buffer_data[3*i], &color_buffer_data[0], 3*sizeof(GLfloat)) == 0;
+    glm::vec3 color (color_buffer_data[0], color_buffer_data[1], color_buffer_data[2]);
+    if (solid && color != glm::vec3(1, 1, 1)) {
+        std::vector<GLfloat> white_buffer_data (3*numVertices, 1.0f);
+        struct VAO* white = create3DObject(primitive_mode, numVertices, vertex_buffer_data, &white_buffer_data[0], fill_mode);
+        auto range = MeshTints.equal_range(white);
+        for (auto it = range.first; it != range.second; ++it)
+            if (it->second->Color == color)
+                return it->second;
+        struct VAO* vao = new struct VAO (*white);
+        vao->Color = color;
+        MeshTints.insert(std::make_pair(white, vao));
+        return vao;
+    }
+
+    MeshRequests++;
+
+    uint64_t hash = hashBytes(&primitive_mode, sizeof(primitive_mode));
+    hash = hashBytes(&fill_mode, sizeof(fill_mode), hash);
+    hash = hashBytes(&numVertices, sizeof(numVertices), hash);
+    hash = hashBytes(vertex_buffer_data, 3*numVertices*sizeof(GLfloat), hash);
+    hash = hashBytes(color_buffer_data, 3*numVertices*sizeof(GLfloat), hash);
+
+    auto range = MeshRegistry.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        const MeshEntry& entry = it->second;
+        if (entry.vao->PrimitiveMode == primitive_mode && entry.vao->FillMode == fill_mode &&
+            (int)entry.vertices.size() == 3*numVertices &&
+            memcmp(&entry.vertices[0], vertex_buffer_data, 3*numVertices*sizeof(GLfloat)) == 0 &&
+            memcmp(&entry.colors[0], color_buffer_data, 3*numVertices*sizeof(GLfloat)) == 0)
+            return entry.vao;
+    }
+
     struct VAO* vao = new struct VAO;
     vao->PrimitiveMode = primitive_mode;
-    vao->NumVertices = numVertices;
     vao->FillMode = fill_mode;
+    vao->Solid = solid;
+    vao->Color = glm::vec3(1, 1, 1);
+
+    // Append the mesh to the shared buffers in the compact format, indexing
+    // repeated vertices (eg. the two shared corners of a rectangle) only once
+    // The GL copy is only updated by flushMeshBuffer, so this needs no GL context
+    vao->FirstIndex = Meshes.Indices.size();
+    vao->NumIndices = numVertices;
+    vao->BaseVertex = Meshes.Vertices.size();
+    std::unordered_map<uint64_t, GLushort> indexOf;
+    for (int i=0; i<numVertices; i++) {
+        MeshVertex vertex;
+        vertex.x = floatToHalf(vertex_buffer_data [3*i]);
+        vertex.y = floatToHalf(vertex_buffer_data [3*i + 1]);
+        vertex.r = (GLubyte)(glm::clamp(color_buffer_data [3*i], 0.0f, 1.0f)*255 + 0.5f);
+        vertex.g = (GLubyte)(glm::clamp(color_buffer_data [3*i + 1], 0.0f, 1.0f)*255 + 0.5f);
+        vertex.b = (GLubyte)(glm::clamp(color_buffer_data [3*i + 2], 0.0f, 1.0f)*255 + 0.5f);
+        vertex.a = 255;
+
+        uint64_t key;
+        memcpy(&key, &vertex, sizeof(key));
+        auto found = indexOf.find(key);
+        if (found == indexOf.end()) {
+            found = indexOf.insert(std::make_pair(key, (GLushort)(Meshes.Vertices.size() - vao->BaseVertex))).first;
+            Meshes.Vertices.push_back(vertex);
+            Meshes.Positions.push_back(glm::vec2(vertex_buffer_data [3*i], vertex_buffer_data [3*i + 1]));
+        }
+        Meshes.Indices.push_back(found->second);
+    }
+    vao->NumVertices = Meshes.Vertices.size() - vao->BaseVertex;
+
+    vao->Extent = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+    for (int i=0; i<numVertices; i++) {
+        vao->Extent.MinX = min(vao->Extent.MinX, vertex_buffer_data [3*i]);
+        vao->Extent.MinY = min(vao->Extent.MinY, vertex_buffer_data [3*i + 1]);
+        vao->Extent.MaxX = max(vao->Extent.MaxX, vertex_buffer_data [3*i]);
+        vao->Extent.MaxY = max(vao->Extent.MaxY, vertex_buffer_data [3*i + 1]);
+    }
 
-    // Create Vertex Array Object
-    // Should be done after CreateWindow and before any other GL calls
-    glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
-    glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
-    glVertexAttribPointer(
-                          0,                  // attribute 0. Vertices
-                          3,                  // size (x,y,z)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
-
-    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-    glVertexAttribPointer(
-                          1,                  // attribute 1. Color
-                          3,                  // size (r,g,b)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
+    MeshEntry entry;
+    entry.vao = vao;
+    entry.vertices.assign(vertex_buffer_data, vertex_buffer_data + 3*numVertices);
+    entry.colors.assign(color_buffer_data, color_buffer_data + 3*numVertices);
+    MeshRegistry.insert(std::make_pair(hash, entry));
 
     return vao;
 }
 
-glm::vec3 getRGBfromHue (int hue)
+glm::vec3 getRGBfromHue (int hue)
+{
+	float intp;
+	float fracp = modff(hue/60.0, &intp);
+	float x = 1.0 - abs((float)((int)intp%2)+fracp-1.0);
+
+
+	return glm::vec3(1,1,1);
+	/*if (hue < 60)
+		return glm::vec3(1,x,0);
+	else if (hue < 120)
+		return glm::vec3(x,1,0);
+	else if (hue < 180)
+		return glm::vec3(0,1,x);
+	else if (hue < 240)
+		return glm::vec3(0,x,1);
+	else if (hue < 300)
+		return glm::vec3(x,0,1);
+	else
+		return glm::vec3(1,0,x);*/
+}
+
+/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
+{
+    std::vector<GLfloat> color_buffer_data (3*numVertices);
+    for (int i=0; i<numVertices; i++) {
+        color_buffer_data [3*i] = red;
+        color_buffer_data [3*i + 1] = green;
+        color_buffer_data [3*i + 2] = blue;
+    }
+
+    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, &color_buffer_data[0], fill_mode);
+}
+
+/* Turn the instance attribute array of the mesh VAO on or off */
+/* It is VAO state, so consecutive draws of the same kind leave it alone */
+void setInstanceArrays (bool enabled)
+{
+    if (Meshes.InstanceArrays == enabled) {
+        GLState.Skipped++;
+        return;
+    }
+    if (enabled)
+        glEnableVertexAttribArray (2);
+    else {
+        // GL 3.3 leaves the generic value undefined after a draw that read the array,
+        // so it is set again, to slot 0, the identity transform in white
+        glDisableVertexAttribArray (2);
+        glVertexAttribI1i (2, 0);
+    }
+    Meshes.InstanceArrays = enabled;
+    GLState.Issued++;
+}
+
+/* Render the mesh from the shared mesh buffer, placed by the transform in the given object slot */
+void draw3DObject (struct VAO* vao, int object = 0)
+{
+    // Change the Fill Mode for this object
+    setPolygonMode (vao->FillMode);
+
+    // Every mesh is drawn through the same VAO, so this is normally skipped
+    bindVertexArray (Meshes.VertexArrayID);
+
+    // Non instanced draws read their object slot from the generic attribute value
+    setInstanceArrays (false);
+    glVertexAttribI1i (2, object);
+
+    // Draw the geometry !
+    glDrawElementsBaseVertex(vao->PrimitiveMode, vao->NumIndices, GL_UNSIGNED_SHORT,
+                             (void*)(vao->FirstIndex*sizeof(GLushort)), vao->BaseVertex);
+    GLState.DrawCalls++;
+}
+
+/* Transform and colour of one object, 5 texels of the "Objects" buffer texture */
+struct ObjectData {
+    glm::mat4 model;
+    glm::vec4 color;
+};
+
+const GLuint CAMERA_BLOCK_BINDING = 0; // uniform block binding of "Camera"
+const GLint OBJECTS_TEXTURE_UNIT = 1;  // texture unit of "Objects"
+
+/* Data shared by every program, uploaded once per frame */
+/* The camera is a uniform block, the objects a buffer texture indexed from the shaders */
+struct FrameBuffers {
+    GLuint CameraBuffer;   // UBO - view projection matrix
+    glm::mat4 Camera;      // as last uploaded
+    bool CameraValid;
+
+    GLuint ObjectBuffer;   // TBO - one ObjectData per object drawn this frame
+    GLuint ObjectTexture;
+    std::vector<ObjectData> Objects;
+
+    GLuint SlotBuffer;     // VBO - object slot of each instance, in submission order
+    std::vector<GLint> Slots;
+} Frame;
+
+/* Generate the per-frame buffers */
+void createFrameBuffers ()
+{
+    glGenBuffers (1, &Frame.CameraBuffer);
+    glBindBuffer (GL_UNIFORM_BUFFER, Frame.CameraBuffer);
+    glBufferData (GL_UNIFORM_BUFFER, sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase (GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, Frame.CameraBuffer);
+    Frame.CameraValid = false;
+
+    glGenBuffers (1, &Frame.ObjectBuffer);
+    glGenTextures (1, &Frame.ObjectTexture);
+    glBindBuffer (GL_TEXTURE_BUFFER, Frame.ObjectBuffer);
+    glBufferData (GL_TEXTURE_BUFFER, sizeof(ObjectData), NULL, GL_STREAM_DRAW);
+    glActiveTexture (GL_TEXTURE0 + OBJECTS_TEXTURE_UNIT);
+    glBindTexture (GL_TEXTURE_BUFFER, Frame.ObjectTexture);
+    glTexBuffer (GL_TEXTURE_BUFFER, GL_RGBA32F, Frame.ObjectBuffer);
+    glActiveTexture (GL_TEXTURE0);
+
+    glGenBuffers (1, &Frame.SlotBuffer);
+
+    // Generic slot used by draws with the slot array disabled
+    glVertexAttribI1i (2, 0);
+}
+
+/* Point the "Camera" block and the "Objects" sampler of a linked program at the shared buffers */
+void bindFrameBuffers (GLuint program)
+{
+    GLuint camera = glGetUniformBlockIndex (program, "Camera");
+    if (camera != GL_INVALID_INDEX)
+        glUniformBlockBinding (program, camera, CAMERA_BLOCK_BINDING);
+
+    useProgram (program);
+    glUniform1i (glGetUniformLocation(program, "Objects"), OBJECTS_TEXTURE_UNIT);
+}
+
+/* Hand the scene program with the given features to the driver */
+void beginSceneVariant (ProgramBuild& build, unsigned features)
+{
+    std::string defines;
+    for (int i=0; i<SCENE_FEATURE_COUNT; i++)
+        if (features & (1 << i))
+            defines += SceneFeatureDefines[i];
+    beginProgram(build, "Sample_GL.vert", "Sample_GL.frag", defines.c_str());
+}
+
+/* Link a variant begun by beginSceneVariant into the cache */
+GLuint finishSceneVariant (ProgramBuild& build, unsigned features)
+{
+    SceneVariants[features] = finishProgram(build);
+    bindFrameBuffers(SceneVariants[features]);
+    return SceneVariants[features];
+}
+
+/* The scene program with the given features, built on its first use */
+GLuint sceneVariant (unsigned features)
+{
+    if (SceneVariants[features])
+        return SceneVariants[features];
+    ProgramBuild build;
+    beginSceneVariant(build, features);
+    return finishSceneVariant(build, features);
+}
+
+/* Start the object list of a new frame, slot 0 is the identity transform in white */
+void beginObjects ()
+{
+    Frame.Objects.clear();
+    Frame.Objects.push_back({glm::mat4(1.0f), glm::vec4(1,1,1,1)});
+}
+
+/* Add an object to this frame and return its slot */
+int addObject (const glm::mat4& model, glm::vec3 color=glm::vec3(1,1,1))
+{
+    Frame.Objects.push_back({model, glm::vec4(color, 1)});
+    return Frame.Objects.size() - 1;
+}
+
+/* Upload the camera and every object of this frame, once all of them are recorded */
+void uploadFrame (const glm::mat4& VP)
+{
+    if (!Frame.CameraValid || memcmp(&Frame.Camera, &VP, sizeof(glm::mat4)) != 0) {
+        glBindBuffer (GL_UNIFORM_BUFFER, Frame.CameraBuffer);
+        glBufferSubData (GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), &VP[0][0]);
+        Frame.Camera = VP;
+        Frame.CameraValid = true;
+        GLState.Issued++;
+    }
+    else
+        GLState.Skipped++;
+
+    // Orphan last frame's objects, the GPU may still be reading them
+    glBindBuffer (GL_TEXTURE_BUFFER, Frame.ObjectBuffer);
+    glBufferData (GL_TEXTURE_BUFFER, Frame.Objects.size()*sizeof(ObjectData), &Frame.Objects[0], GL_STREAM_DRAW);
+}
+
+/* Create the shared VAO and copy the meshes added since the last flush into it */
+/* The buffers are reallocated at their exact size, so memory stays tightly packed */
+void flushMeshBuffer ()
+{
+    if ((int)Meshes.Indices.size() == Meshes.UploadedIndices)
+        return;
+
+    if (Meshes.VertexArrayID == 0) {
+        // Create Vertex Array Object
+        // Should be done after CreateWindow and before any other GL calls
+        glGenVertexArrays(1, &(Meshes.VertexArrayID)); // VAO
+        glGenBuffers (1, &(Meshes.VertexBuffer)); // VBO - vertices and colors
+        glGenBuffers (1, &(Meshes.IndexBuffer));  // IBO - indices
+        bindVertexArray (Meshes.VertexArrayID);
+
+        bindArrayBuffer (Meshes.VertexBuffer);
+        glVertexAttribPointer(
+                              0,                  // attribute 0. Vertices
+                              2,                  // size (x,y)
+                              GL_HALF_FLOAT,      // type
+                              GL_FALSE,           // normalized?
+                              sizeof(MeshVertex), // stride
+                              (void*)0            // array buffer offset
+                              );
+        glVertexAttribPointer(
+                              1,                  // attribute 1. Color
+                              4,                  // size (r,g,b,a)
+                              GL_UNSIGNED_BYTE,   // type
+                              GL_TRUE,            // normalized?
+                              sizeof(MeshVertex), // stride
+                              (void*)(2*sizeof(GLhalf)) // array buffer offset
+                              );
+        glEnableVertexAttribArray(0); // Vertex Attribute 0 - 2d Vertices
+        glEnableVertexAttribArray(1); // Vertex Attribute 1 - Color
+
+        // Attribute 2 - object slot, advanced once per instance
+        // Indirect draws offset it with their baseInstance, so the pointer never changes
+        bindArrayBuffer (Frame.SlotBuffer);
+        glVertexAttribIPointer (2, 1, GL_INT, sizeof(GLint), (void*)0);
+        glVertexAttribDivisor (2, 1);
+    }
+
+    bindArrayBuffer (Meshes.VertexBuffer);
+    glBufferData (GL_ARRAY_BUFFER, Meshes.Vertices.size()*sizeof(MeshVertex), &Meshes.Vertices[0], GL_STATIC_DRAW);
+
+    // The element array binding is VAO state
+    bindVertexArray (Meshes.VertexArrayID);
+    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, Meshes.IndexBuffer);
+    glBufferData (GL_ELEMENT_ARRAY_BUFFER, Meshes.Indices.size()*sizeof(GLushort), &Meshes.Indices[0], GL_STATIC_DRAW);
+    Meshes.UploadedIndices = Meshes.Indices.size();
+}
+
+/* Layers are submitted in this order, whatever order they were recorded in */
+enum DrawLayer {
+    LAYER_BACKGROUND, // land, platforms, targets, obstacles
+    LAYER_SCENE,      // cannon, balls, blowers
+    LAYER_HUD         // power and wind meters, lives
+};
+
+/* A draw recorded by draw() and submitted later by submitDrawList */
+struct DrawCommand {
+    struct VAO* Mesh;
+    GLuint Program;
+    GLenum FillMode;
+    int Layer;
+    int Object;        // transform and colour slot in Frame.Objects
+    uint64_t SortKey;  // layer, program, fill mode, mesh : equal keys can share one draw call
+};
+
+/* The draws of one frame, kept separate from their GL submission */
+struct DrawList {
+    std::vector<DrawCommand> Commands;
+} Scene;
+
+void clearDrawList (DrawList& list)
+{
+    list.Commands.clear();
+}
+
+/* Part of the world inside the ortho projection, set by reshapeWindow */
+Bounds View = {-8, -4, 8, 4};
+float ViewScale = 1;  // framebuffer pixels per world unit
+
+/* True when the local rectangle, placed by model, overlaps the view */
+/* Works on the centre and half size, so a rotated rectangle keeps a tight enclosing box */
+bool boundsVisible (const Bounds& local, const glm::mat4& model)
+{
+    float cx = (local.MinX + local.MaxX)/2, cy = (local.MinY + local.MaxY)/2;
+    float ex = (local.MaxX - local.MinX)/2, ey = (local.MaxY - local.MinY)/2;
+    float x = model[0][0]*cx + model[1][0]*cy + model[3][0];
+    float y = model[0][1]*cx + model[1][1]*cy + model[3][1];
+    float halfWidth = fabsf(model[0][0])*ex + fabsf(model[1][0])*ey;
+    float halfHeight = fabsf(model[0][1])*ex + fabsf(model[1][1])*ey;
+    return x + halfWidth >= View.MinX && x - halfWidth <= View.MaxX &&
+           y + halfHeight >= View.MinY && y - halfHeight <= View.MaxY;
+}
+
+GLuint sceneProgram (const struct VAO* mesh);
+
+/* Record a draw of the mesh with the given model matrix, no GL call is made here */
+/* Meshes outside the view are dropped before they take an object slot */
+/* The program defaults to the cheapest variant of the scene program that draws the mesh */
+void recordDraw (DrawList& list, struct VAO* mesh, const glm::mat4& model, int layer,
+                 glm::vec3 color=glm::vec3(1,1,1), GLuint program=0)
+{
+    if (!boundsVisible(mesh->Extent, model)) {
+        GLState.Culled++;
+        return;
+    }
+
+    DrawCommand command;
+    command.Mesh = mesh;
+    command.Program = program ? program : sceneProgram(mesh);
+    command.FillMode = mesh->FillMode;
+    command.Layer = layer;
+    command.Object = addObject(model, color * mesh->Color);
+
+    uint64_t fill = (mesh->FillMode == GL_FILL) ? 0 : (mesh->FillMode == GL_LINE) ? 1 : 2;
+    command.SortKey = ((uint64_t)layer << 56) | ((uint64_t)(command.Program & 0xffff) << 40) |
+                      (fill << 32) | (uint64_t)mesh->FirstIndex;
+
+    list.Commands.push_back(command);
+}
+
+/* Layout of one draw in the indirect buffer, as read by glMultiDrawElementsIndirect */
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+/* Vertex of the world space copies used when indirect draws are not available */
+struct StreamVertex {
+    GLfloat x, y;
+    GLubyte r, g, b, a;
+};
+
+/* Buffers that let a whole draw list go out with one multi-draw call per state */
+struct MultiDrawBuffers {
+    bool Indirect; // ARB_multi_draw_indirect and ARB_base_instance are available
+
+    // Indirect path : baseInstance selects each draw's first entry in Frame.SlotBuffer
+    GLuint IndirectBuffer;
+    std::vector<DrawElementsIndirectCommand> Commands; // as last uploaded
+    std::vector<int> Runs; // indirect command of each sorted draw
+
+    // Fallback path : meshes pre-transformed to world space, drawn with glMultiDrawElementsBaseVertex
+    GLuint StreamVertexArrayID;
+    GLuint StreamBuffer;
+    std::vector<StreamVertex> Vertices;
+} MultiDraw;
+
+/* Features a mesh needs : the pretransformed path draws world space vertices coloured on the CPU, */
+/* the indirect path fetches its objects and reads vertex colours only for meshes of several colours */
+unsigned sceneFeatures (const struct VAO* mesh)
+{
+    if (!MultiDraw.Indirect)
+        return FEATURE_VERTEX_COLOR;
+    return FEATURE_INSTANCED | (mesh->Solid ? 0 : FEATURE_VERTEX_COLOR);
+}
+
+GLuint sceneProgram (const struct VAO* mesh)
+{
+    return sceneVariant(sceneFeatures(mesh));
+}
+
+/* Pick the submission path from the extensions of the current context */
+/* MultiDraw.Indirect must be set first, see initGL */
+void initMultiDraw ()
+{
+    if (MultiDraw.Indirect)
+        glGenBuffers (1, &MultiDraw.IndirectBuffer);
+
+    // Same layout as the mesh VAO, with float positions and the shared index buffer
+    glGenVertexArrays (1, &MultiDraw.StreamVertexArrayID);
+    glGenBuffers (1, &MultiDraw.StreamBuffer);
+    // Already in world space and coloured, for the scene variant without INSTANCED, which has no slot attribute
+    bindVertexArray (MultiDraw.StreamVertexArrayID);
+    bindArrayBuffer (MultiDraw.StreamBuffer);
+    glVertexAttribPointer (0, 2, GL_FLOAT, GL_FALSE, sizeof(StreamVertex), (void*)0);
+    glVertexAttribPointer (1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(StreamVertex), (void*)(2*sizeof(GLfloat)));
+    glEnableVertexAttribArray (0);
+    glEnableVertexAttribArray (1);
+    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, Meshes.IndexBuffer);
+}
+
+/* Build one indirect draw per run of equal keys in the sorted list, with the object */
+/* slots of every instance, and upload them for the whole frame */
+void uploadIndirect (DrawList& list)
+{
+    static std::vector<DrawElementsIndirectCommand> commands;
+    commands.clear();
+    MultiDraw.Runs.clear();
+    Frame.Slots.clear();
+
+    for (size_t i=0; i<list.Commands.size(); i++) {
+        const DrawCommand& command = list.Commands[i];
+        if (i == 0 || command.SortKey != list.Commands[i-1].SortKey) {
+            DrawElementsIndirectCommand indirect;
+            indirect.count = command.Mesh->NumIndices;
+            indirect.instanceCount = 0;
+            indirect.firstIndex = command.Mesh->FirstIndex;
+            indirect.baseVertex = command.Mesh->BaseVertex;
+            indirect.baseInstance = i; // slots are uploaded in submission order
+            commands.push_back(indirect);
+        }
+        commands.back().instanceCount++;
+        MultiDraw.Runs.push_back(commands.size() - 1);
+        Frame.Slots.push_back(command.Object);
+    }
+
+    // Slots change every frame, the draws themselves only when the scene does
+    bindArrayBuffer (Frame.SlotBuffer);
+    glBufferData (GL_ARRAY_BUFFER, Frame.Slots.size()*sizeof(GLint), &Frame.Slots[0], GL_STREAM_DRAW);
+
+    glBindBuffer (GL_DRAW_INDIRECT_BUFFER, MultiDraw.IndirectBuffer);
+    if (commands.size() != MultiDraw.Commands.size() ||
+        memcmp(&commands[0], &MultiDraw.Commands[0], commands.size()*sizeof(DrawElementsIndirectCommand)) != 0) {
+        glBufferData (GL_DRAW_INDIRECT_BUFFER, commands.size()*sizeof(DrawElementsIndirectCommand), &commands[0], GL_DYNAMIC_DRAW);
+        MultiDraw.Commands = commands;
+    }
+}
+
+/* Submit sorted commands [first, last) : their runs are consecutive in the indirect */
+/* buffer, so all of them go out in a single glMultiDrawElementsIndirect */
+void submitIndirect (DrawList& list, size_t first, size_t last)
+{
+    int firstRun = MultiDraw.Runs[first];
+    int runs = MultiDraw.Runs[last-1] - firstRun + 1;
+
+    bindVertexArray (Meshes.VertexArrayID);
+    setInstanceArrays (true);
+
+    glMultiDrawElementsIndirect (list.Commands[first].Mesh->PrimitiveMode, GL_UNSIGNED_SHORT,
+                                 (void*)(firstRun*sizeof(DrawElementsIndirectCommand)), runs, 0);
+    GLState.DrawCalls++;
+}
+
+/* Submit sorted commands [first, last) without indirect draws : GL 3.3 has no way to */
+/* pick a per-draw transform inside glMultiDrawElementsBaseVertex, so the meshes are */
+/* transformed to world space here and the whole range still goes out in one call */
+void submitPretransformed (DrawList& list, size_t first, size_t last)
+{
+    static std::vector<GLsizei> counts;
+    static std::vector<void*> offsets;
+    static std::vector<GLint> baseVertices;
+    counts.clear();
+    offsets.clear();
+    baseVertices.clear();
+    MultiDraw.Vertices.clear();
+
+    for (size_t i=first; i<last; i++) {
+        const DrawCommand& command = list.Commands[i];
+        const ObjectData& instance = Frame.Objects[command.Object];
+        struct VAO* mesh = command.Mesh;
+
+        counts.push_back(mesh->NumIndices);
+        offsets.push_back((void*)(mesh->FirstIndex*sizeof(GLushort)));
+        baseVertices.push_back(MultiDraw.Vertices.size());
+
+        for (int v=mesh->BaseVertex; v<mesh->BaseVertex + mesh->NumVertices; v++) {
+            const MeshVertex& vertex = Meshes.Vertices[v];
+            glm::vec4 position = instance.model * glm::vec4(Meshes.Positions[v].x, Meshes.Positions[v].y, 0, 1);
+            StreamVertex world;
+            world.x = position.x;
+            world.y = position.y;
+            world.r = (GLubyte)(vertex.r*instance.color.x + 0.5f);
+            world.g = (GLubyte)(vertex.g*instance.color.y + 0.5f);
+            world.b = (GLubyte)(vertex.b*instance.color.z + 0.5f);
+            world.a = vertex.a;
+            MultiDraw.Vertices.push_back(world);
+        }
+    }
+
+    bindVertexArray (MultiDraw.StreamVertexArrayID);
+    bindArrayBuffer (MultiDraw.StreamBuffer);
+    glBufferData (GL_ARRAY_BUFFER, MultiDraw.Vertices.size()*sizeof(StreamVertex), &MultiDraw.Vertices[0], GL_STREAM_DRAW);
+
+    glMultiDrawElementsBaseVertex (list.Commands[first].Mesh->PrimitiveMode, &counts[0], GL_UNSIGNED_SHORT,
+                                   &offsets[0], counts.size(), &baseVertices[0]);
+    GLState.DrawCalls++;
+}
+
+/* Sort the recorded draws by state and send them to GL in one pass */
+/* Every range of draws sharing program, fill mode and primitive is a single multi-draw call */
+/* The camera and objects must already be uploaded with uploadFrame */
+void submitDrawList (DrawList& list)
+{
+    // stable, so draws with equal keys keep their recording order
+    std::stable_sort(list.Commands.begin(), list.Commands.end(),
+                     [](const DrawCommand& a, const DrawCommand& b) { return a.SortKey < b.SortKey; });
+
+    if (MultiDraw.Indirect && !list.Commands.empty())
+        uploadIndirect (list);
+
+    size_t first = 0;
+    while (first < list.Commands.size()) {
+        const DrawCommand& command = list.Commands[first];
+        size_t last = first + 1;
+        while (last < list.Commands.size() && list.Commands[last].Program == command.Program &&
+               list.Commands[last].FillMode == command.FillMode &&
+               list.Commands[last].Mesh->PrimitiveMode == command.Mesh->PrimitiveMode)
+            last++;
+
+        useProgram (command.Program);
+        setPolygonMode (command.FillMode);
+        setBlend (command.Program == circleProgramID); // antialiased edges
+        if (MultiDraw.Indirect)
+            submitIndirect (list, first, last);
+        else if (command.Program == SceneVariants[FEATURE_VERTEX_COLOR])
+            submitPretransformed (list, first, last);
+        else {
+            // Other programs need the mesh in its own space, draw them one by one
+            for (size_t i=first; i<last; i++)
+                draw3DObject (list.Commands[i].Mesh, list.Commands[i].Object);
+        }
+        first = last;
+    }
+}
+
+/* One em of text, in model units. The FTGL shader this replaces divided positions */
+/* by w = 2, so its glyphs covered half a unit per em */
+const float TEXT_EM = 0.5f;
+
+struct TextVertex {
+    GLfloat x, y;   // in model units
+    GLfloat s, t;   // atlas coordinates
+    GLint object;   // transform slot in Frame.Objects
+};
+
+/* Quads of every recorded string, rebuilt and drawn in one call per submission */
+struct TextBatch {
+    GLuint VertexArrayID;
+    GLuint VertexBuffer;
+    std::vector<TextVertex> Vertices;
+} TextBuffer;
+
+void createTextBuffer ()
+{
+    glGenVertexArrays (1, &TextBuffer.VertexArrayID);
+    glGenBuffers (1, &TextBuffer.VertexBuffer);
+    bindVertexArray (TextBuffer.VertexArrayID);
+    bindArrayBuffer (TextBuffer.VertexBuffer);
+    glVertexAttribPointer (0, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)0);
+    glVertexAttribPointer (1, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)(2*sizeof(GLfloat)));
+    glVertexAttribIPointer (2, 1, GL_INT, sizeof(TextVertex), (void*)(4*sizeof(GLfloat)));
+    glEnableVertexAttribArray (0);
+    glEnableVertexAttribArray (1);
+    glEnableVertexAttribArray (2);
+}
+
+/* Upload the glyph atlas, its distance is filtered linearly between texels */
+void createGlyphTexture (int width, int height, const unsigned char* pixels)
+{
+    glGenTextures (1, &Font.texture);
+    glBindTexture (GL_TEXTURE_2D, Font.texture);
+    glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+/* An atlas file mapped by mapGlyphAtlas, uploaded straight from the mapping */
+struct MappedGlyphAtlas {
+    void* Mapping;
+    size_t Size;
+    const GlyphAtlasHeader* Header;
+    const GlyphInfo* Glyphs;
+    const unsigned char* Pixels;
+};
+
+/* Map an atlas baked by fontbake, no GL call is made here */
+/* Returns false if the file is missing or was baked with different settings */
+bool mapGlyphAtlas (const char* path, MappedGlyphAtlas& atlas)
+{
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+        return false;
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size < (off_t)sizeof(GlyphAtlasHeader)) {
+        close(file);
+        return false;
+    }
+    void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    const GlyphAtlasHeader* header = (const GlyphAtlasHeader*)mapping;
+    GlyphAtlasHeader expected = glyphAtlasHeader(header->Width, header->Height);
+    size_t size = sizeof(GlyphAtlasHeader) + GLYPH_COUNT*sizeof(GlyphInfo) + (size_t)header->Width*header->Height;
+    if (memcmp(header, &expected, sizeof(GlyphAtlasHeader)) != 0 || (size_t)info.st_size != size) {
+        munmap(mapping, info.st_size);
+        return false;
+    }
+    atlas.Mapping = mapping;
+    atlas.Size = info.st_size;
+    atlas.Header = header;
+    atlas.Glyphs = (const GlyphInfo*)(header + 1);
+    atlas.Pixels = (const unsigned char*)(atlas.Glyphs + GLYPH_COUNT);
+    return true;
+}
+
+/* Lay out the string's glyph quads from the pen at the origin, along the baseline */
+void layoutText (const char* text, std::vector<TextVertex>& vertices, Bounds& extent)
+{
+    vertices.clear();
+    extent = {0, 0, 0, 0};
+    float pen = 0;
+    for (const char* c=text; *c; c++) {
+        int index = (*c >= GLYPH_FIRST && *c < GLYPH_FIRST + GLYPH_COUNT) ? *c - GLYPH_FIRST : '?' - GLYPH_FIRST;
+        const GlyphInfo& glyph = Font.Glyphs[index];
+        if (glyph.x1 > glyph.x0) {
+            float x0 = (pen + glyph.x0)*TEXT_EM, x1 = (pen + glyph.x1)*TEXT_EM;
+            float y0 = glyph.y0*TEXT_EM, y1 = glyph.y1*TEXT_EM;
+            TextVertex topLeft = {x0, y1, glyph.s0, glyph.t0, 0};
+            TextVertex topRight = {x1, y1, glyph.s1, glyph.t0, 0};
+            TextVertex bottomLeft = {x0, y0, glyph.s0, glyph.t1, 0};
+            TextVertex bottomRight = {x1, y0, glyph.s1, glyph.t1, 0};
+            vertices.push_back(bottomLeft);
+            vertices.push_back(bottomRight);
+            vertices.push_back(topRight);
+            vertices.push_back(topRight);
+            vertices.push_back(topLeft);
+            vertices.push_back(bottomLeft);
+            extent.MinX = min(extent.MinX, x0);
+            extent.MinY = min(extent.MinY, y0);
+            extent.MaxX = max(extent.MaxX, x1);
+            extent.MaxY = max(extent.MaxY, y1);
+        }
+        pen += glyph.advance;
+    }
+}
+
+/* A string whose glyph quads are kept between frames, laid out again only when it changes */
+struct TextObject {
+    char Text[48];                   // numbers are formatted in place with std::to_chars
+    long long Value;                 // number after the prefix, when HasValue
+    bool HasValue;
+    bool Dirty;                      // Text changed since Quads were laid out
+    std::vector<TextVertex> Quads;   // with object slot 0, set when submitted
+    Bounds Extent;                   // of Quads
+};
+
+/* Show a fixed string */
+void setText (TextObject& label, const char* text)
+{
+    if (!label.HasValue && strncmp(label.Text, text, sizeof(label.Text)) == 0)
+        return;
+    strncpy(label.Text, text, sizeof(label.Text) - 1);
+    label.Text[sizeof(label.Text) - 1] = '\0';
+    label.HasValue = false;
+    label.Dirty = true;
+}
+
+/* Show prefix followed by value, formatted only when either changes */
+void setText (TextObject& label, const char* prefix, long long value)
+{
+    size_t length = strnlen(prefix, sizeof(label.Text)/2);
+    if (label.HasValue && label.Value == value && strncmp(label.Text, prefix, length) == 0)
+        return;
+    memcpy(label.Text, prefix, length);
+    std::to_chars_result result = std::to_chars(label.Text + length, label.Text + sizeof(label.Text) - 1, value);
+    *result.ptr = '\0'; // the prefix leaves room for any long long
+    label.Value = value;
+    label.HasValue = true;
+    label.Dirty = true;
+}
+
+/* A label recorded by draw(), rendered from the glyph atlas with the transform in its object slot */
+struct TextCommand {
+    TextObject* Label;
+    int Object;
+};
+
+struct TextList {
+    std::vector<TextCommand> Commands;
+} Texts;
+
+void clearTextList (TextList& list)
+{
+    list.Commands.clear();
+}
+
+/* Record a label, laid out first if it changed so its bounds can be checked against the view */
+void recordText (TextList& list, TextObject& label, const glm::mat4& model)
+{
+    if (label.Dirty) {
+        layoutText (label.Text, label.Quads, label.Extent);
+        label.Dirty = false;
+    }
+    if (label.Quads.empty() || !boundsVisible(label.Extent, model)) {
+        GLState.Culled++;
+        return;
+    }
+    list.Commands.push_back({&label, addObject(model)});
+}
+
+/* Labels drawn by draw(), the fixed ones are set once by createLabels */
+struct GameLabels {
+    TextObject Score, Level;
+    TextObject Reload, Wind, Blowers, Shooter, GameOver, Jupiter;
+} Labels;
+
+void createLabels ()
+{
+    setText(Labels.Reload, "Press R or Middle mouse click to Reload");
+    setText(Labels.Wind, "WIND");
+    setText(Labels.Blowers, "Blowers");
+    setText(Labels.Shooter, "Shooter");
+    setText(Labels.GameOver, "Game Over");
+    setText(Labels.Jupiter, "JUPITER");
+}
+
+/* Render every recorded string with a single draw call */
+void submitTextList (TextList& list, glm::vec3 color)
+{
+    TextBuffer.Vertices.clear();
+    for (size_t i=0; i<list.Commands.size(); i++) {
+        TextObject& label = *list.Commands[i].Label;
+        size_t first = TextBuffer.Vertices.size();
+        TextBuffer.Vertices.insert(TextBuffer.Vertices.end(), label.Quads.begin(), label.Quads.end());
+        for (size_t v=first; v<TextBuffer.Vertices.size(); v++)
+            TextBuffer.Vertices[v].object = list.Commands[i].Object;
+    }
+    if (TextBuffer.Vertices.empty())
+        return;
+
+    useProgram (fontProgramID);
+    setPolygonMode (GL_FILL);
+    setBlend (true); // antialiased edges
+    glUniform3fv (Font.fontColorID, 1, &color[0]);
+    glBindTexture (GL_TEXTURE_2D, Font.texture);
+
+    bindVertexArray (TextBuffer.VertexArrayID);
+    bindArrayBuffer (TextBuffer.VertexBuffer);
+    glBufferData (GL_ARRAY_BUFFER, TextBuffer.Vertices.size()*sizeof(TextVertex), &TextBuffer.Vertices[0], GL_STREAM_DRAW);
+    glDrawArrays (GL_TRIANGLES, 0, TextBuffer.Vertices.size());
+    GLState.DrawCalls++;
+}
+
+/* Hash of the recorded strings, their transforms and colour, chained through hash */
+uint64_t textListSignature (TextList& list, glm::vec3 color, uint64_t hash)
+{
+    hash = hashBytes(&color, sizeof(color), hash);
+    for (size_t i=0; i<list.Commands.size(); i++) {
+        hash = hashBytes(list.Commands[i].Label->Text, strlen(list.Commands[i].Label->Text) + 1, hash);
+        hash = hashBytes(&Frame.Objects[list.Commands[i].Object], sizeof(ObjectData), hash);
+    }
+    return hash | 1; // never 0
+}
+
+/* Offscreen copy of a layer that rarely changes, redrawn only when its signature does */
+struct LayerTarget {
+    GLuint Framebuffer;
+    GLuint Texture;
+    int Width, Height;
+    float Depth;          // where the composite goes : 1 behind everything, -1 in front of everything
+    bool Blend;           // composite with its alpha, the texture holds premultiplied colours
+    bool Complete;        // false if the driver rejected the framebuffer, the layer is then drawn directly
+    uint64_t Signature;   // of the draws currently in the texture, 0 when it must be redrawn
+    int DrawWidth, DrawHeight;  // part of the texture drawn to, from its bottom left corner
+    GLuint DepthBuffer;   // 0 for layers drawn without depth
+};
+
+LayerTarget BackgroundLayer = {0, 0, 0, 0, 1.0f, false, false, 0, 0, 0, 0};
+DrawList Background;      // LAYER_BACKGROUND draws, recorded every frame but rarely submitted
+
+LayerTarget HudLayer = {0, 0, 0, 0, -1.0f, true, false, 0, 0, 0, 0};
+DrawList Hud;             // LAYER_HUD draws, redrawn with the text when either changes
+
+// The scene at another resolution than the screen, stretched over it
+LayerTarget SceneLayer = {0, 0, 0, 0, 1.0f, false, false, 0, 0, 0, 0};
+
+GLuint ScreenVertexArrayID; // no attributes, the screen triangle comes from gl_VertexID
+GLint LayerDepthID;         // "layerDepth" uniform of textureProgramID
+GLint LayerScaleID;         // "layerScale" uniform of textureProgramID
+
+/* A framebuffer and the size of its viewport */
+struct DrawTarget {
+    GLuint Framebuffer;
+    int Width, Height;
+};
+
+DrawTarget Screen;        // the window, set by reshapeWindow
+DrawTarget Target;        // where the scene is drawn this frame : Screen or SceneLayer
+
+/* Give the layer a texture of the framebuffer size, its contents are lost */
+void resizeLayerTarget (LayerTarget& layer, int width, int height)
+{
+    if (layer.Framebuffer == 0) {
+        glGenFramebuffers (1, &layer.Framebuffer);
+        glGenTextures (1, &layer.Texture);
+    }
+    layer.Width = layer.DrawWidth = width;
+    layer.Height = layer.DrawHeight = height;
+    layer.Signature = 0;
+
+    glBindTexture (GL_TEXTURE_2D, layer.Texture);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glBindFramebuffer (GL_FRAMEBUFFER, layer.Framebuffer);
+    glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, layer.Texture, 0);
+    layer.Complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer (GL_FRAMEBUFFER, 0);
+}
+
+/* Hash of everything a draw list puts on screen : meshes, transforms, colours and camera */
+uint64_t drawListSignature (DrawList& list, const glm::mat4& VP)
+{
+    uint64_t hash = hashBytes(&VP, sizeof(glm::mat4));
+    for (size_t i=0; i<list.Commands.size(); i++) {
+        const DrawCommand& command = list.Commands[i];
+        hash = hashBytes(&command.SortKey, sizeof(command.SortKey), hash);
+        hash = hashBytes(&Frame.Objects[command.Object], sizeof(ObjectData), hash);
+    }
+    return hash | 1; // never 0
+}
+
+/* Bind the layer for redrawing if its contents differ from the signature */
+/* Returns false when the cached texture is still valid, otherwise draw then call endLayer */
+bool beginLayer (LayerTarget& layer, uint64_t signature)
+{
+    if (signature == layer.Signature)
+        return false;
+
+    glBindFramebuffer (GL_FRAMEBUFFER, layer.Framebuffer);
+    glViewport (0, 0, layer.DrawWidth, layer.DrawHeight);
+    glClear (GL_COLOR_BUFFER_BIT);
+    layer.Signature = signature;
+    return true;
+}
+
+/* Go back to drawing the scene */
+void endLayer ()
+{
+    glBindFramebuffer (GL_FRAMEBUFFER, Target.Framebuffer);
+    glViewport (0, 0, Target.Width, Target.Height);
+}
+
+/* Draw the layer's texture over the whole screen, at the layer's depth */
+void compositeLayer (LayerTarget& layer)
+{
+    useProgram (textureProgramID);
+    setPolygonMode (GL_FILL);
+    setBlend (layer.Blend);
+    bindVertexArray (ScreenVertexArrayID);
+    glUniform1f (LayerDepthID, layer.Depth);
+    glUniform2f (LayerScaleID, (float)layer.DrawWidth/layer.Width, (float)layer.DrawHeight/layer.Height);
+    glBindTexture (GL_TEXTURE_2D, layer.Texture);
+    glDrawArrays (GL_TRIANGLES, 0, 3);
+    GLState.DrawCalls++;
+}
+
+/* Meters, lives and text : redrawn only when one of them changes, then blended over the scene */
+void submitHud (const glm::mat4& VP, glm::vec3 textColor)
 {
-	float intp;
-	float fracp = modff(hue/60.0, &intp);
-	float x = 1.0 - abs((float)((int)intp%2)+fracp-1.0);
+    if (!HudLayer.Complete) {
+        submitDrawList (Hud);
+        submitTextList (Texts, textColor);
+        return;
+    }
+    uint64_t signature = textListSignature(Texts, textColor, drawListSignature(Hud, VP));
+    if (beginLayer (HudLayer, signature)) {
+        submitDrawList (Hud);
+        submitTextList (Texts, textColor);
+        endLayer ();
+    }
+    compositeLayer (HudLayer);
+}
 
+/* Static scenery : drawn from its cached texture while nothing in it changes */
+/* The objects must already be uploaded with uploadFrame */
+void submitBackground (const glm::mat4& VP)
+{
+    if (!BackgroundLayer.Complete) {
+        submitDrawList (Background);
+        return;
+    }
+    if (beginLayer (BackgroundLayer, drawListSignature(Background, VP))) {
+        submitDrawList (Background);
+        endLayer ();
+    }
+    compositeLayer (BackgroundLayer);
+}
 
-	return glm::vec3(1,1,1);
-	/*if (hue < 60)
-		return glm::vec3(1,x,0);
-	else if (hue < 120)
-		return glm::vec3(x,1,0);
-	else if (hue < 180)
-		return glm::vec3(0,1,x);
-	else if (hue < 240)
-		return glm::vec3(0,x,1);
-	else if (hue < 300)
-		return glm::vec3(x,0,1);
-	else
-		return glm::vec3(1,0,x);*/
+/* Room for the scene at MaxScale, with a depth buffer and filtered when stretched */
+void resizeSceneLayer (int width, int height)
+{
+    resizeLayerTarget (SceneLayer, ceilf(width*Resolution.MaxScale), ceilf(height*Resolution.MaxScale));
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    if (SceneLayer.DepthBuffer == 0)
+        glGenRenderbuffers (1, &SceneLayer.DepthBuffer);
+    glBindRenderbuffer (GL_RENDERBUFFER, SceneLayer.DepthBuffer);
+    glRenderbufferStorage (GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, SceneLayer.Width, SceneLayer.Height);
+    glBindFramebuffer (GL_FRAMEBUFFER, SceneLayer.Framebuffer);
+    glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, SceneLayer.DepthBuffer);
+    SceneLayer.Complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer (GL_FRAMEBUFFER, 0);
 }
 
-/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
+/* Start timing the frame, and move the scale towards the target with the time of an earlier frame */
+/* Fill cost goes with the area, so the scale follows the square root of the time ratio */
+void beginFrameTimer ()
 {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
-    for (int i=0; i<numVertices; i++) {
-        color_buffer_data [3*i] = red;
-        color_buffer_data [3*i + 1] = green;
-        color_buffer_data [3*i + 2] = blue;
+    int previous = 1 - Resolution.Current;
+    GLint available = 0;
+    if (Resolution.Pending[previous])
+        glGetQueryObjectiv (Resolution.Queries[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+        GLuint64 elapsed;
+        glGetQueryObjectui64v (Resolution.Queries[previous], GL_QUERY_RESULT, &elapsed);
+        Resolution.Pending[previous] = false;
+        Resolution.FrameTime = elapsed*1e-9;
+
+        // Shrink quickly when over budget, grow slowly once well under it
+        float wanted = Resolution.Scale * sqrt(Resolution.TargetTime / max(Resolution.FrameTime, 1e-6));
+        if (Resolution.FrameTime > Resolution.TargetTime)
+            Resolution.Scale = max(wanted, Resolution.Scale - 0.05f);
+        else if (Resolution.FrameTime < 0.85*Resolution.TargetTime)
+            Resolution.Scale = min(wanted, Resolution.Scale + 0.01f);
+        Resolution.Scale = min(max(Resolution.Scale, Resolution.MinScale), Resolution.MaxScale);
     }
-
-    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+    glBeginQuery (GL_TIME_ELAPSED, Resolution.Queries[Resolution.Current]);
 }
 
-/* Render the VBOs handled by VAO */
-void draw3DObject (struct VAO* vao)
+void endFrameTimer ()
 {
-    // Change the Fill Mode for this object
-    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+    glEndQuery (GL_TIME_ELAPSED);
+    Resolution.Pending[Resolution.Current] = true;
+    Resolution.Current = 1 - Resolution.Current;
+}
 
-    // Bind the VAO to use
-    glBindVertexArray (vao->VertexArrayID);
+/* Direct the scene to SceneLayer when it is drawn at another size than the screen */
+void beginScene ()
+{
+    int width = lroundf(Screen.Width*Resolution.Scale), height = lroundf(Screen.Height*Resolution.Scale);
+    if (!SceneLayer.Complete || (width == Screen.Width && height == Screen.Height)) {
+        Target = Screen;
+        return;
+    }
+    SceneLayer.DrawWidth = min(max(width, 1), SceneLayer.Width);
+    SceneLayer.DrawHeight = min(max(height, 1), SceneLayer.Height);
+    Target = {SceneLayer.Framebuffer, SceneLayer.DrawWidth, SceneLayer.DrawHeight};
+    glBindFramebuffer (GL_FRAMEBUFFER, Target.Framebuffer);
+    glViewport (0, 0, Target.Width, Target.Height);
+    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
 
-    // Enable Vertex Attribute 0 - 3d Vertices
-    glEnableVertexAttribArray(0);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+/* Stretch the scene over the screen if it went to SceneLayer */
+void endScene ()
+{
+    if (Target.Framebuffer == Screen.Framebuffer)
+        return;
+    Target = Screen;
+    endLayer ();
+    compositeLayer (SceneLayer);
+}
 
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+uint64_t ShownSignature;  // of the frame on screen, 0 when it must be drawn again
 
-    // Draw the geometry !
-    glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+/* Hash of everything the recorded frame puts on screen */
+uint64_t frameSignature (const glm::mat4& VP, glm::vec3 textColor)
+{
+    uint64_t signatures[3] = {drawListSignature(Background, VP), drawListSignature(Scene, VP),
+                              textListSignature(Texts, textColor, drawListSignature(Hud, VP))};
+    return hashBytes(signatures, sizeof(signatures)) | 1; // never 0
 }
+
 float camera_rotation_angle = 90;
 float rectangle_rotation = 0;
 float triangle_rotation = 0;
@@ -256,11 +1640,11 @@ long long int score=0;
 float timed=0.02;
 double initialx,initialy,mousex,mousey;
 
-int difficulty=1,arrow=0,level=1,gameover=0;
+int difficulty=1,arrow=0,level=1,gameover=0,statsflag=0;
 int width = 1366;
 int height = 768;
 
-GLFWwindow* window = initGLFW(width, height);
+GLFWwindow* window; // opened by main once the startup workers are running
 
 
 /* Executed when a regular key is pressed/released/held-down */
@@ -312,6 +1696,9 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 	    case GLFW_KEY_ENTER:
 		limitflag=1;
                 break;
+	    case GLFW_KEY_I:                  //toggle render stats on the console
+		statsflag=!statsflag;
+                break;
 
 	    case GLFW_KEY_UP:
             	zoom+=0.5;
@@ -461,9 +1848,38 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
 
     // Ortho projection for 2D views
     Matrices.projection = glm::ortho(-8.0+zoom+pan, 8.0-zoom+pan, -4.0+zoom, 4.0-zoom, 0.1, 500.0);
+    // The camera looks down -z from above the origin. Zoomed past 4 the edges cross and the
+    // ortho projection mirrors the scene, which still shows everything between them
+    float left = -8.0f+zoom+pan, right = 8.0f-zoom+pan, bottom = -4.0f+zoom, top = 4.0f-zoom;
+    View = {min(left, right), min(bottom, top), max(left, right), max(bottom, top)};
+    ViewScale = fbwidth / (View.MaxX - View.MinX);
+    Screen = Target = {0, fbwidth, fbheight};
+
+    // Cached layers follow the framebuffer size, the projection is part of their signature
+    if (BackgroundLayer.Width != fbwidth || BackgroundLayer.Height != fbheight)
+        resizeLayerTarget (BackgroundLayer, fbwidth, fbheight);
+    if (HudLayer.Width != fbwidth || HudLayer.Height != fbheight)
+        resizeLayerTarget (HudLayer, fbwidth, fbheight);
+    if (SceneLayer.Width != (int)ceilf(fbwidth*Resolution.MaxScale) || SceneLayer.Height != (int)ceilf(fbheight*Resolution.MaxScale))
+        resizeSceneLayer (fbwidth, fbheight);
+    ShownSignature = 0;
 }
 
-VAO *triangle, *rectangle1, *triangle1, *rectangle2, *rectangle3, *triangle2;
+/* Executed when the window's contents were lost, e.g. after being uncovered */
+void refreshWindow (GLFWwindow* window)
+{
+    ShownSignature = 0;
+}
+
+VAO *triangle, *rectangle1, *triangle1, *rectangle2, *rectangle3, *triangle2, *circleQuad;
+
+/* The disc as fans of 12, 24, ... 192 segments */
+const int CIRCLE_LEVELS = 5;
+const int CIRCLE_SEGMENTS = 12;
+VAO *circleLevels[CIRCLE_LEVELS];
+
+/* Maps the unit circle onto the game's disc, the ellipse of centre (0,0.1) and radii (sqrt(0.45),0.6) */
+glm::mat4 circleShape;
 
 // Creates the triangle object used in this sample code
 void createTriangle ()
@@ -529,6 +1945,222 @@ void createTriangle2 ()
   triangle2 = create3DObject(GL_TRIANGLES, 3, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
+// Creates the disc used for the cannon base, the balls and the lives
+void createCircle ()
+{
+  /* The unit circle as a fan, once per level of detail, each level doubling the segments */
+  /* circleLevel picks one from the size of the disc on screen */
+  for (int level=0; level<CIRCLE_LEVELS; level++) {
+    int segments = CIRCLE_SEGMENTS << level;
+    GLfloat* vertex_buffer_data = new GLfloat [3*3*segments];
+    for (int i=0; i<segments; i++) {
+      float a0 = 2*M_PI*i/segments, a1 = 2*M_PI*(i + 1)/segments;
+      GLfloat* v = vertex_buffer_data + 9*i;
+      v[0] = 0;        v[1] = 0;        v[2] = 0; // centre
+      v[3] = cosf(a0); v[4] = sinf(a0); v[5] = 0;
+      v[6] = cosf(a1); v[7] = sinf(a1); v[8] = 0;
+    }
+    circleLevels[level] = create3DObject(GL_TRIANGLES, 3*segments, vertex_buffer_data, 1, 1, 1, GL_FILL);
+    delete [] vertex_buffer_data;
+  }
+
+  /* The same disc for circleProgramID : a single quad around the unit circle, the shader */
+  /* keeps the pixels inside it. The margin leaves room for the antialiased edge */
+  static const GLfloat quad_buffer_data [] = {
+    -1.1,-1.1,0, // vertex 0
+    1.1,-1.1,0, // vertex 1
+    1.1,1.1,0, // vertex 2
+
+    1.1,1.1,0, // vertex 2
+    -1.1,1.1,0, // vertex 3
+    -1.1,-1.1,0, // vertex 0
+  };
+  circleQuad = create3DObject(GL_TRIANGLES, 6, quad_buffer_data, 1, 1, 1, GL_FILL);
+  circleShape = glm::translate(glm::vec3(0, 0.1, 0)) * glm::scale(glm::vec3(sqrtf(0.45f), 0.6f, 1));
+}
+
+/* The coarsest fan whose edges stay within a quarter pixel of the unit circle placed by shape, */
+/* in pixels of the scene at its current resolution */
+VAO* circleLevel (const glm::mat4& shape)
+{
+  float radius = max(hypotf(shape[0][0], shape[0][1]), hypotf(shape[1][0], shape[1][1])) * ViewScale * Resolution.Scale;
+  for (int level=0; level<CIRCLE_LEVELS-1; level++) {
+    int segments = CIRCLE_SEGMENTS << level;
+    if (radius * (1 - cosf(M_PI/segments)) <= 0.25f)
+      return circleLevels[level];
+  }
+  return circleLevels[CIRCLE_LEVELS-1];
+}
+
+/* Record a filled disc through the circle mesh, tessellated for its size on screen */
+void recordCircleMesh (DrawList& list, const glm::mat4& model, int layer, glm::vec3 color=glm::vec3(1,1,1))
+{
+  glm::mat4 shape = model * circleShape;
+  recordDraw(list, circleLevel(shape), shape, layer, color);
+}
+
+/* Record a filled disc, as one quad through circleProgramID when it is available */
+void recordCircle (DrawList& list, const glm::mat4& model, int layer, glm::vec3 color=glm::vec3(1,1,1))
+{
+  if (circleProgramID)
+    recordDraw(list, circleQuad, model * circleShape, layer, color, circleProgramID);
+  else
+    recordCircleMesh(list, model, layer, color);
+}
+
+/* A node of the retained scene graph : World = parent World * Local */
+struct SceneNode {
+    int Parent;        // -1 for roots, parents are always stored before their children
+    glm::mat4 Local;
+    glm::mat4 World;
+    glm::vec3 Inputs;  // values Local was last built from, see nodeChanged
+    bool Dirty;        // Local changed since World was computed
+    bool Updated;      // World was recomputed by the last updateSceneGraph
+};
+
+struct SceneGraph {
+    std::vector<SceneNode> Nodes;
+} Graph;
+
+/* Add a node below parent, its world matrix is valid right away */
+int addNode (int parent, const glm::mat4& local=glm::mat4(1.0f))
+{
+    SceneNode node;
+    node.Parent = parent;
+    node.Local = local;
+    node.World = (parent < 0) ? local : Graph.Nodes[parent].World * local;
+    node.Inputs = glm::vec3(NAN); // never equal, the first nodeChanged builds Local
+    node.Dirty = false;
+    node.Updated = true;
+    Graph.Nodes.push_back(node);
+    GLState.Transforms++;
+    return Graph.Nodes.size() - 1;
+}
+
+/* True when the values a node's Local is built from differ from last time */
+/* Only then is the caller expected to rebuild it with setNodeLocal */
+bool nodeChanged (int node, float a, float b=0, float c=0)
+{
+    glm::vec3 inputs(a, b, c);
+    if (Graph.Nodes[node].Inputs == inputs)
+        return false;
+    Graph.Nodes[node].Inputs = inputs;
+    return true;
+}
+
+void setNodeLocal (int node, const glm::mat4& local)
+{
+    Graph.Nodes[node].Local = local;
+    Graph.Nodes[node].Dirty = true;
+}
+
+/* Recompute the world matrices of the dirty nodes and everything below them */
+/* Parents come first in Graph.Nodes, so a single pass in order is enough */
+void updateSceneGraph ()
+{
+    for (size_t i=0; i<Graph.Nodes.size(); i++) {
+        SceneNode& node = Graph.Nodes[i];
+        bool parentUpdated = node.Parent >= 0 && Graph.Nodes[node.Parent].Updated;
+        node.Updated = node.Dirty || parentUpdated;
+        if (!node.Updated)
+            continue;
+        node.World = (node.Parent < 0) ? node.Local : Graph.Nodes[node.Parent].World * node.Local;
+        node.Dirty = false;
+        GLState.Transforms++;
+    }
+}
+
+const glm::mat4& nodeWorld (int node)
+{
+    return Graph.Nodes[node].World;
+}
+
+/* Node of the i-th item of a row of identical objects, added the first time it is needed */
+int rowNode (std::vector<int>& row, int i, int parent, const glm::mat4& local)
+{
+    while ((int)row.size() <= i)
+        row.push_back(-1);
+    if (row[i] < 0)
+        row[i] = addNode(parent, local);
+    return row[i];
+}
+
+/* Nodes of the game objects, the ones that move are placed by draw() */
+struct GameNodes {
+    int Cannon;          // whole cannon, follows movetranslate when it rolls
+    int CannonBase;      // wheel, spins with moverotate
+    int CannonPivot;     // turns with rotateangle
+    int Barrel;
+    int CannonBody;
+    int Ball;            // moves with the cannon before it is shot
+    int Ball2;           // level 3 and 4
+    int Land;
+    int Target1, Target2;
+    int Obstacle1, Obstacle2;
+    int WindArrow;
+    int BlowerPlatform;
+    int Arrowheads[3];
+    int ShooterPlatform, ShooterStand;
+    std::vector<int> PowerBars, WindBars, Lives, ArrowRows;
+} Node;
+
+void createSceneGraph ()
+{
+  Node.Cannon = addNode(-1);
+  Node.CannonBase = addNode(Node.Cannon);
+  Node.CannonPivot = addNode(Node.Cannon);
+  // Barrel and body are fixed relative to the pivot at (-6.4,-3.4)
+  Node.Barrel = addNode(Node.CannonPivot, glm::translate(glm::vec3(0.35, 0.35, 0)) * glm::rotate((float)(42*M_PI/180.0f), glm::vec3(0,0,1)) *
+                                          glm::scale(glm::vec3(0.6f, 0.13f, 0.3f)));
+  Node.CannonBody = addNode(Node.CannonPivot, glm::translate(glm::vec3(0.5, 0.2, 0)) * glm::rotate((float)(45*M_PI/180.0f), glm::vec3(0,0,1)) *
+                                              glm::shear(glm::vec3(0.6f, 0.13f, 0.3f)));
+  Node.Ball = addNode(Node.Cannon);
+  Node.Ball2 = addNode(-1);
+
+  Node.Land = addNode(-1, glm::translate(glm::vec3(0, -4.0, 0)) * glm::scale(glm::vec3(7.0f, 0.1f, 0.3f)));
+  Node.Target1 = addNode(-1, glm::translate(glm::vec3(3, 2, 0)) * glm::scale(glm::vec3(0.3f, 0.3f, 0.3f)));
+  Node.Target2 = addNode(-1, glm::translate(glm::vec3(6, 2, 0)) * glm::scale(glm::vec3(0.3f, 0.3f, 0.3f)));
+  Node.Obstacle1 = addNode(-1);
+  Node.Obstacle2 = addNode(-1);
+  Node.WindArrow = addNode(-1);
+
+  Node.BlowerPlatform = addNode(-1, glm::translate(glm::vec3(4.5, -3.8, 0)) * glm::scale(glm::vec3(0.5, 0.3, 1.0f)));
+  for (int i=0; i<3; i++)
+    Node.Arrowheads[i] = addNode(-1, glm::translate(glm::vec3(4.1+i*0.4, -2.0, 0)) * glm::rotate((float)(-180*M_PI/180.0f), glm::vec3(0,0,1)) *
+                                     glm::scale(glm::vec3(0.25f, 0.25f, 0.25f)));
+
+  Node.ShooterPlatform = addNode(-1, glm::translate(glm::vec3(3.0, -3.8, 0)) * glm::scale(glm::vec3(0.3, 0.7, 1.0f)));
+  Node.ShooterStand = addNode(-1, glm::translate(glm::vec3(3.0, -3.2, 0)));
+}
+
+/* Rebuild the local matrices of the nodes whose inputs changed since the last frame */
+void moveSceneNodes ()
+{
+  if (nodeChanged(Node.Cannon, movetranslate))
+    setNodeLocal(Node.Cannon, glm::translate(glm::vec3(movetranslate, 0, 0)));
+  if (nodeChanged(Node.CannonBase, moverotate))
+    setNodeLocal(Node.CannonBase, glm::translate(glm::vec3(-6.5, -3.7, 0)) * glm::rotate((float)(moverotate*M_PI/180.0f), glm::vec3(0,-0.5,1)) *
+                                  glm::scale(glm::vec3(0.6f, 0.6f, 0.6f)));
+  if (nodeChanged(Node.CannonPivot, rotateangle))
+    setNodeLocal(Node.CannonPivot, glm::translate(glm::vec3(-6.4, -3.4, 0)) * glm::rotate((float)(5*rotateangle*M_PI/180.0f), glm::vec3(0,0,1)));
+  if (nodeChanged(Node.Ball, ballx, bally))
+    setNodeLocal(Node.Ball, glm::translate(glm::vec3(ballx, bally, 0)) * glm::scale(glm::vec3(0.3f, 0.3f, 0.3f)));
+  if (nodeChanged(Node.Ball2, ballx2, bally2))
+    setNodeLocal(Node.Ball2, glm::translate(glm::vec3(ballx2, bally2, 0)) * glm::scale(glm::vec3(0.5f, 0.5f, 0.5f)));
+
+  static const glm::mat4 obstacle = glm::rotate((float)(90*M_PI/180.0f), glm::vec3(0,0,1)) * glm::scale(glm::vec3(1.8f, 0.10f, 0.3f));
+  if (nodeChanged(Node.Obstacle1, upy))
+    setNodeLocal(Node.Obstacle1, glm::translate(glm::vec3(1, upy, 0)) * obstacle);
+  if (nodeChanged(Node.Obstacle2, downy))
+    setNodeLocal(Node.Obstacle2, glm::translate(glm::vec3(1, downy, 0)) * obstacle);
+
+  if (nodeChanged(Node.WindArrow, friction))
+    setNodeLocal(Node.WindArrow, glm::translate(glm::vec3(0+7.5-(friction*200), 3.0, 0)) * glm::rotate((float)(-90*M_PI/180.0f), glm::vec3(0,0,1)) *
+                                 glm::scale(glm::vec3(0.25f, 0.25f, 0.25f)));
+
+  updateSceneGraph();
+}
+
 // Creates the rectangle object used in this sample code
 void createRectangle ()
 {
@@ -613,14 +2245,12 @@ void createRectangle3 ()
 
 /* Render the scene with openGL */
 /* Edit this function according to your assignment */
-void draw ()
+/* Record the frame, and draw it unless it matches the one on screen */
+/* Returns true when a new frame was drawn and must be swapped in */
+bool draw ()
 {
-  // clear the color and depth in the frame buffer
-  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-  // use the loaded shader program
-  // Don't change unless you know what you are doing
-  glUseProgram (programID);
+  // Upload meshes created since the last frame, if any
+  flushMeshBuffer();
 
   // Eye - Location of camera. Don't change unless you are sure!!
   glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
@@ -638,545 +2268,190 @@ void draw ()
   //  Don't change unless you are sure!!
   glm::mat4 VP = Matrices.projection * Matrices.view;
 
-  // Send our transformation to the currently bound shader, in the "MVP" uniform
-  // For each model you render, since the MVP will be different (at least the M part)
-  //  Don't change unless you are sure!!
-  glm::mat4 MVP;	// MVP = Projection * View * Model
-
-  // Load identity to model matrix
-  Matrices.model = glm::mat4(1.0f);
-
-  /* Render your scene */
-  for (int i=0;i<360;i++){
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleTriangle = glm::scale (glm::vec3(0.6f, 0.6f, 0.6f));
-  glm::mat4 translateTriangle = glm::translate (glm::vec3(-6.5+movetranslate,-3.7,0)); // glTranslatef
-  glm::mat4 rotateTriangle = glm::rotate((float)((i+moverotate)*M_PI/180.0f), glm::vec3(0,-0.5,1));  // Cannon
-  glm::mat4 triangleTransform = translateTriangle * rotateTriangle * scaleTriangle;
-  Matrices.model *= triangleTransform; 
-  MVP = VP * Matrices.model; // MVP = p * V * M
-
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(triangle);
-  }
+  /* Record your scene */
+  /* Only the model matrices are computed here, submitDrawList makes the GL calls */
+  /* VP reaches the shaders once, through the "Camera" block, and each model once, through "Objects" */
+  double record_start = glfwGetTime();
+  beginObjects();
+  clearDrawList(Scene);
+  clearDrawList(Background);
+  clearDrawList(Hud);
+  clearTextList(Texts);
+
+  // The cannon rolls before anything is placed, so all of its parts move together
   moverotate+=5*rotatestatus;
   movetranslate+=0.01*rotatestatus;
+  moveSceneNodes();
 
+  recordCircleMesh(Scene, nodeWorld(Node.CannonBase), LAYER_SCENE);                     // Cannon
+  recordCircle(Scene, nodeWorld(Node.Ball), LAYER_SCENE);                              // Ball
 
-  
-  
-  for (int i=0;i<360;i++){
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleTriangle = glm::scale (glm::vec3(0.3f, 0.3f, 0.3f));
-  glm::mat4 translateTriangle = glm::translate (glm::vec3(movetranslate,0,0)); // glTranslatef
-  glm::mat4 rotateTriangle = glm::rotate((float)(i*M_PI/180.0f), glm::vec3(0,-0.5,1));  		// Ball
-  glm::mat4 translateCircle1 = glm::translate (glm::vec3(ballx, bally, 0)); 
-  //glm::mat4 translateCircle1 = glm::translate (glm::vec3(6.4-movetranslate, 3.4, 0)); 
-  //glm::mat4 rotateCircle = glm::rotate((float)(5*rotateangle*M_PI/180.0f), glm::vec3(0,0,1));
-  //glm::mat4 translateCircle2 = glm::translate (glm::vec3(-6.4+movetranslate, -3.4, 0)); 
-  glm::mat4 triangleTransform =translateCircle1 * translateTriangle * rotateTriangle * scaleTriangle;
-  Matrices.model *= triangleTransform; 
-  MVP = VP * Matrices.model; // MVP = p * V * M
-
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(triangle1);
-  }
-
-if(rect3flag==2){
-for (int i=0;i<360;i++){
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleTriangle20 = glm::scale (glm::vec3(0.5f, 0.5f, 0.5f));
-  glm::mat4 translateTriangle20 = glm::translate (glm::vec3(0,0,0)); // glTranslatef
-  glm::mat4 rotateTriangle20 = glm::rotate((float)(i*M_PI/180.0f), glm::vec3(0,-0.5,1));  		// Level 3 Ball
-  glm::mat4 translateCircle20 = glm::translate (glm::vec3(ballx2, bally2, 0)); 
-  //glm::mat4 translateCircle1 = glm::translate (glm::vec3(6.4-movetranslate, 3.4, 0)); 
-  //glm::mat4 rotateCircle = glm::rotate((float)(5*rotateangle*M_PI/180.0f), glm::vec3(0,0,1));
-  //glm::mat4 translateCircle2 = glm::translate (glm::vec3(-6.4+movetranslate, -3.4, 0)); 
-  glm::mat4 triangleTransform20 =translateCircle20 * translateTriangle20 * rotateTriangle20 * scaleTriangle20;
-  Matrices.model *= triangleTransform20; 
-  MVP = VP * Matrices.model; // MVP = p * V * M
-
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  draw3DObject(triangle1);
-  }
-  }
-
-
-
-if(rect3flag==3){
-for (int i=0;i<360;i++){
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleTriangle40 = glm::scale (glm::vec3(0.5f, 0.5f, 0.5f));
-  glm::mat4 translateTriangle40 = glm::translate (glm::vec3(0,0,0)); // glTranslatef
-  glm::mat4 rotateTriangle40 = glm::rotate((float)(i*M_PI/180.0f), glm::vec3(0,-0.5,1));  		// Level 4 Ball
-  glm::mat4 translateCircle40 = glm::translate (glm::vec3(ballx2, bally2, 0)); 
-  //glm::mat4 translateCircle1 = glm::translate (glm::vec3(6.4-movetranslate, 3.4, 0)); 
-  //glm::mat4 rotateCircle = glm::rotate((float)(5*rotateangle*M_PI/180.0f), glm::vec3(0,0,1));
-  //glm::mat4 translateCircle2 = glm::translate (glm::vec3(-6.4+movetranslate, -3.4, 0)); 
-  glm::mat4 triangleTransform40 =translateCircle40 * translateTriangle40 * rotateTriangle40 * scaleTriangle40;
-  Matrices.model *= triangleTransform40; 
-  MVP = VP * Matrices.model; // MVP = p * V * M
-
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  draw3DObject(triangle1);
-  }
+if(rect3flag==2||rect3flag==3){
+  recordCircle(Scene, nodeWorld(Node.Ball2), LAYER_SCENE);                             // Level 3 and 4 Ball
   }
 
-  // Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
-  // glPopMatrix ();
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle = glm::scale (glm::vec3(0.6f, 0.13f, 0.3f));
-  glm::mat4 translateRectangle = glm::translate (glm::vec3(-6.05+movetranslate, -3.05, 0));        // Cannon
-  glm::mat4 rotateRectangle = glm::rotate((float)(42*M_PI/180.0f), glm::vec3(0,0,1)); 
-  glm::mat4 translateRectangle1 = glm::translate (glm::vec3(6.4-movetranslate, 3.4, 0)); 
-  glm::mat4 rotateRectangle3 = glm::rotate((float)(5*rotateangle*M_PI/180.0f), glm::vec3(0,0,1));
-  glm::mat4 translateRectangle3 = glm::translate (glm::vec3(-6.4+movetranslate, -3.4, 0)); 
-  Matrices.model *= (translateRectangle3 * rotateRectangle3 *translateRectangle1* translateRectangle * rotateRectangle * scaleRectangle);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(rectangle1);
-
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle8 = glm::scale (glm::vec3(7.0f, 0.1f, 0.3f));
-  glm::mat4 translateRectangle8 = glm::translate (glm::vec3(0, -4.0, 0));        // Land
-  Matrices.model *= (translateRectangle8 * scaleRectangle8);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-  draw3DObject(rectangle1);
-
-
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle2 = glm::shear (glm::vec3(0.6f, 0.13f, 0.3f));
-  glm::mat4 translateRectangle2 = glm::translate (glm::vec3(-5.9+movetranslate, -3.2, 0));        // Cannon
-  glm::mat4 rotateRectangle2 = glm::rotate((float)(45*M_PI/180.0f), glm::vec3(0,0,1));               
-  glm::mat4 translateRectangle4 = glm::translate (glm::vec3(6.4-movetranslate, 3.4, 0)); 
-  glm::mat4 rotateRectangle4 = glm::rotate((float)(5*rotateangle*M_PI/180.0f), glm::vec3(0,0,1));
-  glm::mat4 translateRectangle5 = glm::translate (glm::vec3(-6.4+movetranslate, -3.4, 0)); 
-  Matrices.model *= (translateRectangle5*rotateRectangle4 * translateRectangle4*translateRectangle2 * rotateRectangle2 * scaleRectangle2);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(rectangle2);
-
-
-Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle14 = glm::scale (glm::vec3(0.3f, 0.3f, 0.3f));
-  glm::mat4 translateRectangle14 = glm::translate (glm::vec3(3, 2, 0));
-  Matrices.model *= translateRectangle14 * scaleRectangle14;                       // Target1
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
- 
-
-if(rect3flag==0)
-  draw3DObject(rectangle3);
-
-
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle3 = glm::scale (glm::vec3(0.3f, 0.3f, 0.3f));
-  glm::mat4 translateRectangle7 = glm::translate (glm::vec3(6, 2, 0));                         // Target2
-  Matrices.model *= translateRectangle7 * scaleRectangle3;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
- 
+  recordDraw(Scene, rectangle1, nodeWorld(Node.Barrel), LAYER_SCENE);                  // Cannon
+  recordDraw(Background, rectangle1, nodeWorld(Node.Land), LAYER_BACKGROUND);          // Land
+  recordDraw(Scene, rectangle2, nodeWorld(Node.CannonBody), LAYER_SCENE);              // Cannon
 
-if(rect3flag==1)
-  draw3DObject(rectangle3);
-
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle12 = glm::scale (glm::vec3(1.8f, 0.10f, 0.3f));
-  glm::mat4 translateRectangle12 = glm::translate (glm::vec3(1, upy, 0));        // glTranslatef
-  glm::mat4 rotateRectangle12 = glm::rotate((float)(90*M_PI/180.0f), glm::vec3(0,0,1)); // Obstacle 1
-  Matrices.model *= translateRectangle12 * rotateRectangle12 * scaleRectangle12;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-if(rect3flag==1||rect3flag==3)
-  draw3DObject(rectangle3);
-  /*Matrices.model = glm::mat4(1.0f);
-  MVP = VP * Matrices.model; // MVP = p * V * M
+if(rect3flag==0){
+  recordDraw(Background, rectangle3, nodeWorld(Node.Target1), LAYER_BACKGROUND);       // Target1
+}
 
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);*/
-Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle13 = glm::scale (glm::vec3(1.8f, 0.10f, 0.3f));
-  glm::mat4 translateRectangle13 = glm::translate (glm::vec3(1, downy, 0));        // glTranslatef
-  glm::mat4 rotateRectangle13 = glm::rotate((float)(90*M_PI/180.0f), glm::vec3(0,0,1)); // Obstacle 2
-  Matrices.model *= translateRectangle13 * rotateRectangle13 * scaleRectangle13;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+if(rect3flag==1){
+  recordDraw(Background, rectangle3, nodeWorld(Node.Target2), LAYER_BACKGROUND);       // Target2
+}
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
-if(rect3flag==1||rect3flag==3)
-  draw3DObject(rectangle3);
+if(rect3flag==1||rect3flag==3){
+  recordDraw(Background, rectangle3, nodeWorld(Node.Obstacle1), LAYER_BACKGROUND);     // Obstacle 1
+  recordDraw(Background, rectangle3, nodeWorld(Node.Obstacle2), LAYER_BACKGROUND);     // Obstacle 2
+}
 
 
 for(int i=0;i<limitv;i++){
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle6 = glm::scale (glm::vec3(0.2f, 0.05f, 0.3f));
-  glm::mat4 translateRectangle6 = glm::translate (glm::vec3(-7.5, -1.0+i*0.2, 0));        // Power
-  Matrices.model *= translateRectangle6 * scaleRectangle6;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(rectangle2);
+  int bar = rowNode(Node.PowerBars, i, -1, glm::translate(glm::vec3(-7.5, -1.0+i*0.2, 0)) * glm::scale(glm::vec3(0.2f, 0.05f, 0.3f)));
+  recordDraw(Hud, rectangle2, nodeWorld(bar), LAYER_HUD);                              // Power
  }
 
-for(int i=0;i<(int)(friction*1000);i++){
-	Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle10 = glm::scale (glm::vec3(0.1, 0.03f, 0.3f));
-  glm::mat4 translateRectangle10 = glm::translate (glm::vec3(7.5-i*0.2, 3.0, 0));        // Windspeed
-  Matrices.model *= translateRectangle10 * scaleRectangle10;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  if(rollflag!=1)
-  draw3DObject(rectangle2);
-}
-
 if(rollflag!=1)
 {
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleTriangle11 = glm::scale (glm::vec3(0.25f, 0.25f, 0.25f));
-  glm::mat4 translateTriangle11 = glm::translate (glm::vec3(0+7.5-(friction*200),3.0,0)); // glTranslatef
-  glm::mat4 rotateTriangle11 = glm::rotate((float)(-90*M_PI/180.0f), glm::vec3(0,0,1));  // Windspeed arrow
-  glm::mat4 triangleTransform =translateTriangle11 * rotateTriangle11 * scaleTriangle11;
-  Matrices.model *= triangleTransform; 
-  MVP = VP * Matrices.model; // MVP = p * V * M
-
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+for(int i=0;i<(int)(friction*1000);i++){
+  int bar = rowNode(Node.WindBars, i, -1, glm::translate(glm::vec3(7.5-i*0.2, 3.0, 0)) * glm::scale(glm::vec3(0.1, 0.03f, 0.3f)));
+  recordDraw(Hud, rectangle2, nodeWorld(bar), LAYER_HUD);                              // Windspeed
+}
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(triangle1);
+  recordDraw(Hud, triangle1, nodeWorld(Node.WindArrow), LAYER_HUD);                    // Windspeed arrow
 }
 
 for(int j=0;j<lives;j++)
 {
-	
-for (int i=0;i<360;i++){
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleTriangle5 = glm::scale (glm::vec3(0.3f, 0.3f, 0.3f));
-  glm::mat4 translateTriangle5 = glm::translate (glm::vec3(-7+j*0.5,3.5,0)); // glTranslatef
-  glm::mat4 rotateTriangle5 = glm::rotate((float)(i*M_PI/180.0f), glm::vec3(0,-0.5,1));          // Lives
-  glm::mat4 triangleTransform = translateTriangle5 * rotateTriangle5 * scaleTriangle5;
-  Matrices.model *= triangleTransform; 
-  MVP = VP * Matrices.model; // MVP = p * V * M
-
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(triangle1);
-  }
-
+  int life = rowNode(Node.Lives, j, -1, glm::translate(glm::vec3(-7+j*0.5, 3.5, 0)) * glm::scale(glm::vec3(0.3f, 0.3f, 0.3f)));
+  recordCircle(Hud, nodeWorld(life), LAYER_HUD);                                       // Lives
 }
 
 
-
-Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle16 = glm::scale (glm::vec3(0.5, 0.3, 1.0f));
-  glm::mat4 translateRectangle16 = glm::translate (glm::vec3(4.5 ,-3.8, 0));        // Blower platform`
-  Matrices.model *= translateRectangle16 *scaleRectangle16;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
 if(rect3flag==1)
-  draw3DObject(rectangle2);
-
-
+{
+  recordDraw(Background, rectangle2, nodeWorld(Node.BlowerPlatform), LAYER_BACKGROUND);// Blower platform
 
 for(int i=0;i<arrow;i++){
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle15 = glm::scale (glm::vec3(0.03, 0.2, 1.0f));
-  glm::mat4 translateRectangle15 = glm::translate (glm::vec3(4.1 ,-3.0+i*0.2, 0));        // Blower arrow1`
-  Matrices.model *= translateRectangle15 *scaleRectangle15;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-if(rect3flag==1)  
-draw3DObject(rectangle2);
+  // One node per row, its three arrows are the next three nodes
+  bool newRow = i >= (int)Node.ArrowRows.size();
+  int row = rowNode(Node.ArrowRows, i, -1, glm::translate(glm::vec3(4.5, -3.0+i*0.2, 0)));
+  if (newRow)
+    for (int column=-1; column<=1; column++)
+      addNode(row, glm::translate(glm::vec3(column*0.4, 0, 0)) * glm::scale(glm::vec3(0.03, 0.2, 1.0f)));
+  for (int column=1; column<=3; column++)
+    recordDraw(Scene, rectangle2, nodeWorld(row + column), LAYER_SCENE);              // Blower arrows
 }
 
-
-for(int i=0;i<arrow;i++){
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle17 = glm::scale (glm::vec3(0.03, 0.2, 1.0f));
-  glm::mat4 translateRectangle17 = glm::translate (glm::vec3(4.5 ,-3.0+i*0.2, 0));        // Blower arrow2`
-  Matrices.model *= translateRectangle17 *scaleRectangle17;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-if(rect3flag==1) 
- draw3DObject(rectangle2);
+if(arrow==5)
+for(int i=0;i<3;i++){
+  recordDraw(Scene, triangle1, nodeWorld(Node.Arrowheads[i]), LAYER_SCENE);            // Blower arrowheads
+}
 }
-
-for(int i=0;i<arrow;i++){
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle16 = glm::scale (glm::vec3(0.03, 0.2, 1.0f));
-  glm::mat4 translateRectangle16 = glm::translate (glm::vec3(4.9 ,-3.0+i*0.2, 0));        // Blower arrow3
-  Matrices.model *= translateRectangle16 *scaleRectangle16;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-if(rect3flag==1) 
- draw3DObject(rectangle2);
-}
-
-Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleTriangle13 = glm::scale (glm::vec3(0.25f, 0.25f, 0.25f));
-  glm::mat4 translateTriangle13 = glm::translate (glm::vec3(4.1,-2.0,0)); // glTranslatef
-  glm::mat4 rotateTriangle13 = glm::rotate((float)(-180*M_PI/180.0f), glm::vec3(0,0,1));  // Bolwer arrowhead1
-  glm::mat4 triangleTransform3 =translateTriangle13*rotateTriangle13* scaleTriangle13;
-  Matrices.model *= triangleTransform3; 
-  MVP = VP * Matrices.model; // MVP = p * V * M
-
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-if(arrow==5&&rect3flag==1)  
-draw3DObject(triangle1);
-
-Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleTriangle14 = glm::scale (glm::vec3(0.25f, 0.25f, 0.25f));
-  glm::mat4 translateTriangle14 = glm::translate (glm::vec3(4.5,-2.0,0)); // glTranslatef
-  glm::mat4 rotateTriangle14 = glm::rotate((float)(-180*M_PI/180.0f), glm::vec3(0,0,1));  // Blower arrowhead2
-  glm::mat4 triangleTransform2 =translateTriangle14*rotateTriangle14* scaleTriangle14;
-  Matrices.model *= triangleTransform2; 
-  MVP = VP * Matrices.model; // MVP = p * V * M
-
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-if(arrow==5&&rect3flag==1)  
-draw3DObject(triangle1);
-
-Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleTriangle12 = glm::scale (glm::vec3(0.25f, 0.25f, 0.25f));
-  glm::mat4 translateTriangle12 = glm::translate (glm::vec3(4.9,-2.0,0)); // glTranslatef
-  glm::mat4 rotateTriangle12 = glm::rotate((float)(-180*M_PI/180.0f), glm::vec3(0,0,1));  // Blower arrowhead3
-  glm::mat4 triangleTransform =translateTriangle12*rotateTriangle12* scaleTriangle12;
-  Matrices.model *= triangleTransform; 
-  MVP = VP * Matrices.model; // MVP = p * V * M
-
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-if(arrow==5&&rect3flag==1)  
-draw3DObject(triangle1);
 
 
-Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleRectangle21 = glm::scale (glm::vec3(0.3, 0.7, 1.0f));
-  glm::mat4 translateRectangle21 = glm::translate (glm::vec3(3.0 ,-3.8, 0));        // Shooter platform`
-  Matrices.model *= translateRectangle21 *scaleRectangle21;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
 if(rect3flag==2||rect3flag==3)
-  draw3DObject(rectangle2);
-
-
-Matrices.model = glm::mat4(1.0f);
-  glm::mat4 scaleTriangle30 = glm::scale (glm::vec3(1.0f, 1.0f, 1.0f));
-  glm::mat4 translateTriangle30 = glm::translate (glm::vec3(3.0,-3.2,0)); // glTranslatef
-  glm::mat4 rotateTriangle30 = glm::rotate((float)(0*M_PI/180.0f), glm::vec3(0,0,1));  // Shooter platform
-  glm::mat4 triangleTransform30 =translateTriangle30*rotateTriangle30* scaleTriangle30;
-  Matrices.model *= triangleTransform30; 
-  MVP = VP * Matrices.model; // MVP = p * V * M
-
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-if(rect3flag==2||rect3flag==3)  
-draw3DObject(triangle1);
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
- // Increment angles
-  float increments = 1;
-
+{
+  recordDraw(Background, rectangle2, nodeWorld(Node.ShooterPlatform), LAYER_BACKGROUND); // Shooter platform
+  recordDraw(Background, triangle1, nodeWorld(Node.ShooterStand), LAYER_BACKGROUND);   // Shooter platform
+}
 
-// Render font on screen
+// Record the text
 	static int fontScale = 0;
 	float fontScaleValue = 0.75 + 0.25*sinf(fontScale*M_PI/180.0f);
 	glm::vec3 fontColor = getRGBfromHue (fontScale);
 
-
-
-	// Use font Shaders for next part of code
-	glUseProgram(fontProgramID);
-	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
-
 	// Transform the text
-	Matrices.model = glm::mat4(1.0f);
 	glm::mat4 translateText = glm::translate(glm::vec3(5,3.5,0));
 	glm::mat4 scaleText = glm::scale(glm::vec3(0.6,0.6,0.6));
-	Matrices.model *= (translateText * scaleText);
-	MVP = Matrices.projection * Matrices.view * Matrices.model;
-	// send font's MVP and font color to fond shaders
-	glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
-
 
-	char s[10];
-	strcpy(s,"Score: ");
-	char buffer[100];
-	sprintf(buffer, "%lld", score);
-	strcat(s, buffer);
-	// Render font
-	GL3Font.font->Render(s);
+	setText(Labels.Score, "Score: ", score);
+	recordText(Texts, Labels.Score, translateText * scaleText);
 
 
-	Matrices.model = glm::mat4(1.0f);
 	glm::mat4 translateText1 = glm::translate(glm::vec3(-7.2,3.0,0));
 	glm::mat4 scaleText1 = glm::scale(glm::vec3(0.5,0.5,0.5));
-	Matrices.model *= (translateText1 * scaleText1);
-	MVP = Matrices.projection * Matrices.view * Matrices.model;
-	// send font's MVP and font color to fond shaders
-	glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
-
 	if(readerflag==1)
-		GL3Font.font->Render("Press R or Middle mouse click to Reload");
+		recordText(Texts, Labels.Reload, translateText1 * scaleText1);
 
 
-	Matrices.model = glm::mat4(1.0f);
 	glm::mat4 translateText2 = glm::translate(glm::vec3(7.0,3.15,0));
 	glm::mat4 scaleText2 = glm::scale(glm::vec3(0.5,0.4,0.5));
-	Matrices.model *= (translateText2 * scaleText2);
-	MVP = Matrices.projection * Matrices.view * Matrices.model;
-	// send font's MVP and font color to fond shaders
-	glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
 if(rollflag!=1)
-	GL3Font.font->Render("WIND");
+	recordText(Texts, Labels.Wind, translateText2 * scaleText2);
 
 
 if(rect3flag==1) {
-Matrices.model = glm::mat4(1.0f);
 	glm::mat4 translateText3 = glm::translate(glm::vec3(5.1,-2.0,0));
 	glm::mat4 rotateText3 = glm::rotate((float)(-90*M_PI/180.0f), glm::vec3(0,0,1));
 	glm::mat4 scaleText3 = glm::scale(glm::vec3(0.5,0.4,0.5));
-	Matrices.model *= (translateText3 *rotateText3* scaleText3);
-	MVP = Matrices.projection * Matrices.view * Matrices.model;
-	// send font's MVP and font color to fond shaders
-	glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
-	GL3Font.font->Render("Blowers");
+	recordText(Texts, Labels.Blowers, translateText3 *rotateText3* scaleText3);
 }
 
 
 if(rect3flag==2||rect3flag==3) {
-Matrices.model = glm::mat4(1.0f);
 	glm::mat4 translateText3 = glm::translate(glm::vec3(3.5,-2.75,0));
 	glm::mat4 rotateText3 = glm::rotate((float)(-90*M_PI/180.0f), glm::vec3(0,0,1));
 	glm::mat4 scaleText3 = glm::scale(glm::vec3(0.5,0.4,0.5));
-	Matrices.model *= (translateText3 *rotateText3* scaleText3);
-	MVP = Matrices.projection * Matrices.view * Matrices.model;
-	// send font's MVP and font color to fond shaders
-	glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
-	GL3Font.font->Render("Shooter");
+	recordText(Texts, Labels.Shooter, translateText3 *rotateText3* scaleText3);
 }
 
 
-
-Matrices.model = glm::mat4(1.0f);
 	glm::mat4 translateText4 = glm::translate(glm::vec3(-2,3.5,0));
 	glm::mat4 scaleText4 = glm::scale(glm::vec3(0.6,0.6,0.6));
-	Matrices.model *= (translateText4 * scaleText4);
-	MVP = Matrices.projection * Matrices.view * Matrices.model;
-	// send font's MVP and font color to fond shaders
-	glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
-
-
-	char s1[10];
-	strcpy(s1,"LEVEL ");
-	char buffer1[100];
-	sprintf(buffer1, "%d", level);
-	strcat(s1, buffer1);
-	// Render font
-	GL3Font.font->Render(s1);
 
+	setText(Labels.Level, "LEVEL ", level);
+	recordText(Texts, Labels.Level, translateText4 * scaleText4);
 
 
-Matrices.model = glm::mat4(1.0f);
 	glm::mat4 translateText5 = glm::translate(glm::vec3(-1.6,-0.5,0));
 	glm::mat4 scaleText5 = glm::scale(glm::vec3(0.8,0.8,0.8));
-	Matrices.model *= (translateText5 * scaleText5);
-	MVP = Matrices.projection * Matrices.view * Matrices.model;
-	// send font's MVP and font color to fond shaders
-	glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
-
-
-	char s2[100];
-	strcpy(s2,"Score: ");
-	char buffer2[100];
-	sprintf(buffer2, "%lld", score);
-	strcat(s2, buffer2);
-	// Render font
-	if(lives<=0&&(rollflag==1||gameover>=1))
-	GL3Font.font->Render(s2);
 
+	if(lives<=0&&(rollflag==1||gameover>=1))
+	recordText(Texts, Labels.Score, translateText5 * scaleText5);
 
 
-Matrices.model = glm::mat4(1.0f);
 	glm::mat4 translateText6 = glm::translate(glm::vec3(-2,0,0));
 	glm::mat4 scaleText6 = glm::scale(glm::vec3(1.0,1.0,1.0));
-	Matrices.model *= (translateText6 * scaleText6);
-	MVP = Matrices.projection * Matrices.view * Matrices.model;
-	// send font's MVP and font color to fond shaders
-	glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
-	// Render font
 	if(lives<=0&&(rollflag==1||gameover>=1))
-	GL3Font.font->Render("Game Over");
+	recordText(Texts, Labels.GameOver, translateText6 * scaleText6);
 
 
-
-Matrices.model = glm::mat4(1.0f);
 	glm::mat4 translateText7 = glm::translate(glm::vec3(-3,1.0,0));
 	glm::mat4 scaleText7 = glm::scale(glm::vec3(1.0,1.0,1.0));
-	Matrices.model *= (translateText7 * scaleText7);
-	MVP = Matrices.projection * Matrices.view * Matrices.model;
-	// send font's MVP and font color to fond shaders
-	glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
-	// Render font
 	if(level==5)
-	GL3Font.font->Render("JUPITER");
-
+	recordText(Texts, Labels.Jupiter, translateText7 * scaleText7);
+
+  GLState.RecordTime += glfwGetTime() - record_start;
+
+  /* Submit the recorded scene and text to GL, if they changed */
+  uint64_t signature = frameSignature(VP, fontColor);
+  bool changed = signature != ShownSignature;
+  if (changed) {
+    ShownSignature = signature;
+    beginFrameTimer();
+    double submit_start = glfwGetTime();
+
+    // clear the color and depth in the frame buffer
+    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    uploadFrame(VP);
+    beginScene();
+    submitBackground(VP);
+    submitDrawList(Scene);
+    endScene();
+    submitHud(VP, fontColor);   // always at the screen's resolution
+    GLState.SubmitTime += glfwGetTime() - submit_start;
+    endFrameTimer();
+    GLState.Frames++;
+  }
+  else
+    GLState.Idle++;
 
+  // Increment angles
+  float increments = 1;
 
 	//camera_rotation_angle++; // Simulating camera rotation
 	triangle_rotation = triangle_rotation + increments*triangle_rot_dir*triangle_rot_status;
@@ -1185,17 +2460,19 @@ Matrices.model = glm::mat4(1.0f);
 	// font size and color changes
 	//fontScale = (fontScale + 1) % 360;
 
+	return changed;
 }
 
 /* Initialise glfw window, I/O callbacks and the renderer to use */
 /* Nothing to Edit here */
+/* Open the window and make its context current, NULL if GLFW or the window fails */
 GLFWwindow* initGLFW (int width, int height)
 {
     GLFWwindow* window; // window desciptor/handle
 
     glfwSetErrorCallback(error_callback);
     if (!glfwInit()) {
-        exit(EXIT_FAILURE);
+        return NULL;
     }
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -1207,11 +2484,12 @@ GLFWwindow* initGLFW (int width, int height)
 
     if (!window) {
         glfwTerminate();
-        exit(EXIT_FAILURE);
+        return NULL;
     }
 
     glfwMakeContextCurrent(window);
-    gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
+    // Set GL_LAZY to resolve each GL function on its first call rather than all of them here
+    loadGL(glfwGetProcAddress, getenv("GL_LAZY") != NULL);
     glfwSwapInterval( 1 );
 
     /* --- register callbacks with GLFW --- */
@@ -1222,6 +2500,9 @@ GLFWwindow* initGLFW (int width, int height)
     glfwSetFramebufferSizeCallback(window, reshapeWindow);
     glfwSetWindowSizeCallback(window, reshapeWindow);
 
+    /* Register function to redraw the window when its contents are lost */
+    glfwSetWindowRefreshCallback(window, refreshWindow);
+
     /* Register function to handle window close */
     glfwSetWindowCloseCallback(window, quit);
 
@@ -1254,25 +2535,160 @@ bool checkCollision(float xcor,float ycor, float radius)
 
 /* Initialize the OpenGL rendering properties */
 /* Add all the models to be created here */
-void initGL (GLFWwindow* window, int width, int height)
+/* Startup work that needs no GL context, done on worker threads while main opens the window */
+struct StartupWork {
+    std::thread MeshWorker, FontWorker;
+    MappedGlyphAtlas Atlas;   // the atlas baked by "make", when usable
+    GlyphAtlas Baked;         // otherwise baked here from the font
+    bool Mapped, FontLoaded;
+} Startup;
+
+const char* fontfile = "arial.ttf";
+const char* atlasfile = "arial.atlas"; // baked by "make"
+
+/* Path of a file shipped next to the executable, so it is found from any working directory */
+std::string installedFile (const char* name)
+{
+	char path[4096];
+	ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+	if (length <= 0)
+		return name;
+	path[length] = '\0';
+	*(strrchr(path, '/') + 1) = '\0';
+	return path + std::string(name);
+}
+
+/* Generate the meshes into the MeshBuffer's CPU copy and build the scene graph on them */
+void createMeshes ()
 {
-    /* Objects should be created before any other gl function and shaders */
-	// Create the models
-	createTriangle (); // Generate the VAO, VBOs, vertices data & copy into the array buffer
+	createTriangle (); // Generate the vertices data, uploaded later by flushMeshBuffer
 	createRectangle ();
 	createRectangle2 ();
 	createRectangle3 ();
 	createTriangle1();
 	createTriangle2();
+	createCircle();
+	createSceneGraph();
+}
+
+/* Map the glyph atlas, or bake it from the font when the file is missing or stale */
+void loadFont ()
+{
+	std::string atlas = installedFile(atlasfile), font = installedFile(fontfile);
+	Startup.Mapped = Startup.FontLoaded = mapGlyphAtlas(atlas.c_str(), Startup.Atlas);
+	if (!Startup.Mapped) {
+		cout << "Font atlas `" << atlas << "' unavailable, baking it from `" << font << "'" << endl;
+		Startup.FontLoaded = bakeGlyphAtlas(font.c_str(), Startup.Baked);
+	}
+}
+
+void startWorkers ()
+{
+	Startup.MeshWorker = std::thread(createMeshes);
+	Startup.FontWorker = std::thread(loadFont);
+}
+
+/* Wait for the workers still running, exit would abort while they are joinable */
+void joinWorkers ()
+{
+	if (Startup.MeshWorker.joinable())
+		Startup.MeshWorker.join();
+	if (Startup.FontWorker.joinable())
+		Startup.FontWorker.join();
+}
+
+/* Upload the glyph atlas loaded by loadFont */
+void uploadFont ()
+{
+	if (!Startup.FontLoaded)
+	{
+		cout << "Error: Could not load font `" << installedFile(fontfile) << "'" << endl;
+		glfwTerminate();
+		exit(EXIT_FAILURE);
+	}
+	if (Startup.Mapped) {
+		memcpy(Font.Glyphs, Startup.Atlas.Glyphs, sizeof(Font.Glyphs));
+		createGlyphTexture(Startup.Atlas.Header->Width, Startup.Atlas.Header->Height, Startup.Atlas.Pixels);
+		munmap(Startup.Atlas.Mapping, Startup.Atlas.Size);
+	}
+	else {
+		memcpy(Font.Glyphs, Startup.Baked.Glyphs, sizeof(Font.Glyphs));
+		createGlyphTexture(Startup.Baked.Width, Startup.Baked.Height, &Startup.Baked.Pixels[0]);
+		Startup.Baked = GlyphAtlas();
+	}
+}
+
+/* Finish startup once the context exists : the workers started by startWorkers are joined here */
+void initGL (GLFWwindow* window, int width, int height)
+{
+	invalidateGLState ();
+
+	// Hand every program to the driver before waiting on any, on its own threads where it has them
+	if (GLExtension.KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	else if (GLExtension.ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+	ProgramBuild layerBuild, circleBuild, fontBuild;
+	beginProgram(layerBuild, "texturerender.vert", "texturerender.frag");
+	beginProgram(circleBuild, "circle.vert", "circle.frag");
+	beginProgram(fontBuild, "fontrender.vert", "fontrender.frag");
+
+	// Then the variants of the scene program the registered meshes draw with, once they exist
+	// Any other variant is only built by sceneVariant if something ever draws with it
+	Startup.MeshWorker.join();
+	MultiDraw.Indirect = GLExtension.ARB_multi_draw_indirect && GLExtension.ARB_base_instance;
+	std::vector<unsigned> sceneFeatureSets;
+	for (const auto& registered : MeshRegistry) {
+		unsigned features = sceneFeatures(registered.second.vao);
+		if (std::find(sceneFeatureSets.begin(), sceneFeatureSets.end(), features) == sceneFeatureSets.end())
+			sceneFeatureSets.push_back(features);
+	}
+	std::vector<ProgramBuild> sceneBuilds (sceneFeatureSets.size());
+	for (size_t i=0; i<sceneFeatureSets.size(); i++)
+		beginSceneVariant(sceneBuilds[i], sceneFeatureSets[i]);
+
+	// Upload the models while the programs compile
+	createFrameBuffers();
+	flushMeshBuffer();
+	initMultiDraw();
 	
 	glActiveTexture(GL_TEXTURE0);
 
-	// Create and compile our GLSL program from the shaders
-	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-	// Get a handle for our "MVP" uniform
-	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+	Startup.FontWorker.join();
+	uploadFont();
+	createTextBuffer();
+	createLabels();
+
+	// Attach the "Camera" block and "Objects" buffer texture of each variant
+	for (size_t i=0; i<sceneFeatureSets.size(); i++)
+		finishSceneVariant(sceneBuilds[i], sceneFeatureSets[i]);
+
+	// Copies cached layers to the screen
+	textureProgramID = finishProgram(layerBuild);
+	useProgram(textureProgramID);
+	glUniform1i(glGetUniformLocation(textureProgramID, "layerTexture"), 0);
+	LayerDepthID = glGetUniformLocation(textureProgramID, "layerDepth");
+	LayerScaleID = glGetUniformLocation(textureProgramID, "layerScale");
+	glGenVertexArrays(1, &ScreenVertexArrayID);
+	glGenQueries(2, Resolution.Queries);
+
+	// Balls and lives are drawn by their signed distance, the circle mesh stays as fallback
+	circleProgramID = finishProgram(circleBuild);
+	GLint circleLinked = GL_FALSE;
+	glGetProgramiv(circleProgramID, GL_LINK_STATUS, &circleLinked);
+	if (circleLinked == GL_TRUE)
+		bindFrameBuffers(circleProgramID);
+	else {
+		cout << "Circle shaders unavailable, drawing discs as meshes" << endl;
+		glDeleteProgram(circleProgramID);
+		circleProgramID = 0;
+	}
+
+	fontProgramID = finishProgram(fontBuild);
+	Font.fontColorID = glGetUniformLocation(fontProgramID, "fontColor");
+	bindFrameBuffers(fontProgramID);
+	glUniform1i(glGetUniformLocation(fontProgramID, "glyphAtlas"), 0);
 
-	
 	reshapeWindow (window, width, height);
 
     // Background color of the scene
@@ -1280,47 +2696,75 @@ void initGL (GLFWwindow* window, int width, int height)
 	glClearDepth (1.0f);
 
 	glEnable (GL_DEPTH_TEST);
+	glBlendFunc (GL_ONE, GL_ONE_MINUS_SRC_ALPHA); // premultiplied alpha, enabled by setBlend where needed
 	glDepthFunc (GL_LEQUAL);
 
-const char* fontfile = "arial.ttf";
-	GL3Font.font = new FTExtrudeFont(fontfile); // 3D extrude style rendering
-
-	if(GL3Font.font->Error())
-	{
-		cout << "Error: Could not load font `" << fontfile << "'" << endl;
-		glfwTerminate();
-		exit(EXIT_FAILURE);
-	}
-
-// Create and compile our GLSL program from the font shaders
-	fontProgramID = LoadShaders( "fontrender.vert", "fontrender.frag" );
-	GLint fontVertexCoordAttrib, fontVertexNormalAttrib, fontVertexOffsetUniform;
-	fontVertexCoordAttrib = glGetAttribLocation(fontProgramID, "vertexPosition");
-	fontVertexNormalAttrib = glGetAttribLocation(fontProgramID, "vertexNormal");
-	fontVertexOffsetUniform = glGetUniformLocation(fontProgramID, "pen");
-	GL3Font.fontMatrixID = glGetUniformLocation(fontProgramID, "MVP");
-	GL3Font.fontColorID = glGetUniformLocation(fontProgramID, "fontColor");
-
-	GL3Font.font->ShaderLocations(fontVertexCoordAttrib, fontVertexNormalAttrib, fontVertexOffsetUniform);
-	GL3Font.font->FaceSize(1);
-	GL3Font.font->Depth(0);
-	GL3Font.font->Outset(0, 0);
-	GL3Font.font->CharMap(ft_encoding_unicode);
-
     cout << "VENDOR: " << glGetString(GL_VENDOR) << endl;
     cout << "RENDERER: " << glGetString(GL_RENDERER) << endl;
     cout << "VERSION: " << glGetString(GL_VERSION) << endl;
     cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
+    cout << "SUBMISSION: " << (MultiDraw.Indirect ? "glMultiDrawElementsIndirect" : "glMultiDrawElementsBaseVertex") << endl;
+    cout << "MESHES: " << MeshRegistry.size() << " stored for " << MeshRequests << " created, "
+         << Meshes.Vertices.size()*sizeof(MeshVertex) + Meshes.Indices.size()*sizeof(GLushort) << " bytes" << endl;
+}
+
+/* Read the number following option i, false with a message if it is missing or not a number */
+bool optionValue (int argc, char** argv, int i, double& value)
+{
+	if (i+1 >= argc) {
+		cout << "Option `" << argv[i] << "' needs a value" << endl;
+		return false;
+	}
+	char* end;
+	value = strtod(argv[i+1], &end);
+	if (end == argv[i+1] || *end != '\0' || !std::isfinite(value)) {
+		cout << "Invalid number `" << argv[i+1] << "' for option `" << argv[i] << "'" << endl;
+		return false;
+	}
+	return true;
 }
 
 int main (int argc, char** argv)
 {
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	startWorkers();
+
+	// Dynamic resolution : --min-scale and --max-scale bound the scene's scale, --frame-ms is the GL time to hold
+	// Options that cannot be used are reported and leave their default
+	for (int i=1; i<argc; i++) {
+		bool minScale = strcmp(argv[i], "--min-scale") == 0;
+		bool maxScale = strcmp(argv[i], "--max-scale") == 0;
+		bool frameTime = strcmp(argv[i], "--frame-ms") == 0;
+		if (!minScale && !maxScale && !frameTime) {
+			cout << "Unknown option `" << argv[i] << "'" << endl;
+			continue;
+		}
+		double value;
+		if (!optionValue(argc, argv, i++, value))
+			continue;
+		if (minScale)
+			Resolution.MinScale = value;
+		else if (maxScale)
+			Resolution.MaxScale = value;
+		else
+			Resolution.TargetTime = value/1000;
+	}
+	Resolution.MaxScale = max(Resolution.MaxScale, 0.1f);
+	Resolution.MinScale = min(max(Resolution.MinScale, 0.1f), Resolution.MaxScale);
+	Resolution.Scale = Resolution.MaxScale;
 
+	window = initGLFW(width, height);
+	if (!window) {
+		joinWorkers();
+		exit(EXIT_FAILURE);
+	}
 	initGL (window, width, height);
+	bool first_frame = true;
 
     double last_update_time = glfwGetTime(), current_time;
     double last_update_time3 = glfwGetTime();
     double last_update_time2 = glfwGetTime();
+    double last_stats_time = glfwGetTime();
     /* Draw in loop */
     while (!glfwWindowShouldClose(window)&&gameover!=20) {
 	
@@ -1330,7 +2774,7 @@ int main (int argc, char** argv)
 	//cout<<mousex<<" "<<mousey<<endl;
 
         // OpenGL Draw commands
-        draw();
+        bool drawn = draw();
 	if(shoot==0){
 		/*if(theta>90)
 		theta=90;
@@ -1428,11 +2872,34 @@ int main (int argc, char** argv)
 	if(ballx>8.0||ballx<-8.0||bally>4.0||bally<-4.0)
 		readerflag=1;
 
-        // Swap Frame Buffer in double buffering
-        glfwSwapBuffers(window);
+        // Swap Frame Buffer in double buffering, the last frame stays on screen if nothing changed
+        if (drawn)
+            glfwSwapBuffers(window);
+        if (first_frame) {
+            glFinish();
+            cout << "TIME TO FIRST FRAME: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count() << " ms" << endl;
+            first_frame = false;
+        }
 
         // Poll for Keyboard and mouse events
-        glfwPollEvents();
+        // When idle, sleep until one arrives or the next timer below with something to move is due
+        double due = HUGE_VAL;
+        if ((shoot==1 && (rollflag==0 || xvelocity!=0)) || gflag==1 ||
+            ((rect3flag==1 || rect3flag==3) && (upy>2.1 || downy<-3.5)))
+            due = min(due, last_update_time + 0.01);    // ball in flight, obstacles closing in
+        if (rect3flag!=0 || lives<=0)
+            due = min(due, last_update_time2 + 0.2);    // blower arrows, game over countdown
+        if (rect3flag==2 || rect3flag==3)
+            due = min(due, last_update_time3 + timed);  // bouncing target
+        if (statsflag==1)
+            due = min(due, last_stats_time + 1.0);
+        double timeout = due - glfwGetTime();
+        if (drawn || timeout <= 0)
+            glfwPollEvents();
+        else if (due == HUGE_VAL)
+            glfwWaitEvents();
+        else
+            glfwWaitEventsTimeout(timeout);
 
         // Control based on time (Time based transformation like 5 degrees rotation every 0.05s)
         current_time = glfwGetTime(); // Time in seconds
@@ -1519,6 +2986,13 @@ int main (int argc, char** argv)
 
 
         }
+	if((current_time - last_stats_time) >= 1.0){
+		last_stats_time = current_time;
+		if(statsflag==1)
+		printRenderStats();
+		else
+		resetRenderStats();
+	}
 	if((current_time - last_update_time2) >= 0.2){
 		 last_update_time2 = current_time;
 		if(arrow<5)
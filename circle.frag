@@ -0,0 +1,22 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec3 fragColor;
+in vec2 shapePosition;
+
+// output data
+out vec4 color;
+
+void main()
+{
+    // Signed distance to the edge of the unit circle, negative inside
+    float distance = length(shapePosition) - 1.0;
+
+    // Fade out over one pixel across the edge, whatever the scale of the disc
+    float coverage = clamp(0.5 - distance / fwidth(distance), 0.0, 1.0);
+    if (coverage == 0.0)
+        discard;
+
+    // Premultiplied, like everything drawn into the cached layers
+    color = vec4(fragColor * coverage, coverage);
+}
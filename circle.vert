@@ -0,0 +1,37 @@
+#version 330 core
+
+// input data : sent from main program, the quad around the unit circle
+layout (location = 0) in vec2 vertexPosition;
+layout (location = 1) in vec4 vertexColor;
+
+// per-instance data : slot of this instance in Objects
+layout (location = 2) in int instanceObject;
+
+// shared by every program, uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+// model matrix columns then colour, 5 texels per object
+uniform samplerBuffer Objects;
+
+// output data : used by fragment shader
+out vec3 fragColor;
+out vec2 shapePosition;
+
+void main ()
+{
+    int object = instanceObject * 5;
+    mat4 model = mat4(texelFetch(Objects, object),
+                      texelFetch(Objects, object + 1),
+                      texelFetch(Objects, object + 2),
+                      texelFetch(Objects, object + 3));
+    vec3 color = texelFetch(Objects, object + 4).rgb;
+
+    fragColor = vertexColor.rgb * color;
+
+    // Position in the circle's own space, where it is the unit circle
+    shapePosition = vertexPosition;
+
+    gl_Position = VP * model * vec4(vertexPosition, 0, 1);
+}
@@ -0,0 +1,171 @@
+#ifndef FONTATLAS_H
+#define FONTATLAS_H
+
+/* Signed distance glyph atlas, shared by the game and the fontbake tool */
+
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+/* Printable ASCII, other characters are drawn as '?' */
+#define GLYPH_FIRST 32
+#define GLYPH_COUNT 95
+
+const int GLYPH_PIXEL_SIZE = 48; // em size the glyphs are rasterized at
+const int GLYPH_SPREAD = 6;      // pixels of distance kept on each side of the outline
+
+struct GlyphInfo {
+	float x0, y0, x1, y1; // quad relative to the pen, in em, y up
+	float s0, t0, s1, t1; // atlas coordinates of the (x0,y1) and (x1,y0) corners
+	float advance;        // in em
+};
+
+/* Signed distance field of every glyph, packed in one single channel texture */
+struct GlyphAtlas {
+	int Width, Height;
+	std::vector<unsigned char> Pixels; // 128 on the outline, more inside
+	GlyphInfo Glyphs[GLYPH_COUNT];
+};
+
+/* Layout of a baked atlas file : this header, the glyph table, then Width*Height pixels */
+/* Everything is in the byte order of the machine that baked it */
+struct GlyphAtlasHeader {
+	char Magic[4];         // "SDFA"
+	uint32_t Version;
+	int32_t Width, Height;
+	int32_t First, Count;  // GLYPH_FIRST and GLYPH_COUNT
+	int32_t PixelSize, Spread;
+};
+
+#define GLYPH_ATLAS_VERSION 1
+
+/* Signed distance, in pixels, from each pixel of a padded glyph to its outline */
+/* Brute force over the spread window, run once per glyph */
+inline void glyphDistanceField (const FT_Bitmap& bitmap, int width, int height, unsigned char* field, int stride)
+{
+    std::vector<unsigned char> inside(width*height, 0);
+    for (unsigned int y=0; y<bitmap.rows; y++)
+        for (unsigned int x=0; x<bitmap.width; x++)
+            inside[(y + GLYPH_SPREAD)*width + x + GLYPH_SPREAD] = bitmap.buffer[y*bitmap.pitch + x] >= 128;
+
+    for (int y=0; y<height; y++) {
+        for (int x=0; x<width; x++) {
+            bool in = inside[y*width + x];
+            float nearest = GLYPH_SPREAD;
+            for (int dy=-GLYPH_SPREAD; dy<=GLYPH_SPREAD; dy++) {
+                for (int dx=-GLYPH_SPREAD; dx<=GLYPH_SPREAD; dx++) {
+                    int sx = x + dx, sy = y + dy;
+                    if (sx < 0 || sy < 0 || sx >= width || sy >= height || inside[sy*width + sx] == in)
+                        continue;
+                    nearest = std::min(nearest, sqrtf((float)(dx*dx + dy*dy)) - 0.5f);
+                }
+            }
+            float distance = in ? nearest : -nearest;
+            float value = 128.0f + distance*127.0f/GLYPH_SPREAD;
+            field[y*stride + x] = (unsigned char)std::min(std::max(value, 0.0f), 255.0f);
+        }
+    }
+}
+
+/* Rasterize the printable ASCII glyphs of fontfile into a signed distance atlas */
+inline bool bakeGlyphAtlas (const char* fontfile, GlyphAtlas& atlas)
+{
+    FT_Library library;
+    FT_Face face;
+    if (FT_Init_FreeType(&library))
+        return false;
+    if (FT_New_Face(library, fontfile, 0, &face)) {
+        FT_Done_FreeType(library);
+        return false;
+    }
+    FT_Set_Pixel_Sizes(face, 0, GLYPH_PIXEL_SIZE);
+
+    // Glyphs are placed left to right on shelves as high as their tallest glyph
+    atlas.Width = 512;
+    atlas.Height = 0;
+    atlas.Pixels.clear();
+    int shelfX = 0, shelfY = 0, shelfHeight = 0;
+    float em = GLYPH_PIXEL_SIZE;
+
+    for (int i=0; i<GLYPH_COUNT; i++) {
+        GlyphInfo& glyph = atlas.Glyphs[i];
+        memset(&glyph, 0, sizeof(GlyphInfo));
+        if (FT_Load_Char(face, GLYPH_FIRST + i, FT_LOAD_RENDER))
+            continue;
+        FT_GlyphSlot slot = face->glyph;
+        glyph.advance = (slot->advance.x/64.0f)/em;
+        if (slot->bitmap.width == 0 || slot->bitmap.rows == 0)
+            continue; // space
+
+        int width = slot->bitmap.width + 2*GLYPH_SPREAD;
+        int height = slot->bitmap.rows + 2*GLYPH_SPREAD;
+        if (shelfX + width > atlas.Width) {
+            shelfX = 0;
+            shelfY += shelfHeight;
+            shelfHeight = 0;
+        }
+        shelfHeight = std::max(shelfHeight, height);
+        if (shelfY + shelfHeight > atlas.Height) {
+            atlas.Height = shelfY + shelfHeight;
+            atlas.Pixels.resize(atlas.Width*atlas.Height, 0);
+        }
+        glyphDistanceField(slot->bitmap, width, height, &atlas.Pixels[shelfY*atlas.Width + shelfX], atlas.Width);
+
+        glyph.x0 = (slot->bitmap_left - GLYPH_SPREAD)/em;
+        glyph.x1 = glyph.x0 + width/em;
+        glyph.y1 = (slot->bitmap_top + GLYPH_SPREAD)/em;
+        glyph.y0 = glyph.y1 - height/em;
+        glyph.s0 = shelfX;
+        glyph.t0 = shelfY;
+        glyph.s1 = shelfX + width;
+        glyph.t1 = shelfY + height;
+        shelfX += width;
+    }
+
+    // Pixel positions to texture coordinates, now that the height is final
+    for (int i=0; i<GLYPH_COUNT; i++) {
+        atlas.Glyphs[i].s0 /= atlas.Width;
+        atlas.Glyphs[i].s1 /= atlas.Width;
+        atlas.Glyphs[i].t0 /= std::max(atlas.Height, 1);
+        atlas.Glyphs[i].t1 /= std::max(atlas.Height, 1);
+    }
+
+    FT_Done_Face(face);
+    FT_Done_FreeType(library);
+    return atlas.Height > 0;
+}
+
+/* Header the atlas would be written with, also what a loader expects to find */
+inline GlyphAtlasHeader glyphAtlasHeader (int width, int height)
+{
+    GlyphAtlasHeader header;
+    memcpy(header.Magic, "SDFA", 4);
+    header.Version = GLYPH_ATLAS_VERSION;
+    header.Width = width;
+    header.Height = height;
+    header.First = GLYPH_FIRST;
+    header.Count = GLYPH_COUNT;
+    header.PixelSize = GLYPH_PIXEL_SIZE;
+    header.Spread = GLYPH_SPREAD;
+    return header;
+}
+
+inline bool writeGlyphAtlas (const char* path, const GlyphAtlas& atlas)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+    GlyphAtlasHeader header = glyphAtlasHeader(atlas.Width, atlas.Height);
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(atlas.Glyphs, sizeof(GlyphInfo), GLYPH_COUNT, file) == GLYPH_COUNT &&
+                   fwrite(&atlas.Pixels[0], 1, atlas.Pixels.size(), file) == atlas.Pixels.size();
+    return fclose(file) == 0 && written;
+}
+
+#endif
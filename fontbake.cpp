@@ -0,0 +1,26 @@
+#include <iostream>
+#include "fontatlas.h"
+
+using namespace std;
+
+/* Bake the glyph atlas the game loads at startup : fontbake arial.ttf arial.atlas */
+int main (int argc, char** argv)
+{
+	if (argc != 3) {
+		cout << "Usage: " << argv[0] << " font.ttf output.atlas" << endl;
+		return 1;
+	}
+
+	GlyphAtlas atlas;
+	if (!bakeGlyphAtlas(argv[1], atlas)) {
+		cout << "Error: Could not load font `" << argv[1] << "'" << endl;
+		return 1;
+	}
+	if (!writeGlyphAtlas(argv[2], atlas)) {
+		cout << "Error: Could not write `" << argv[2] << "'" << endl;
+		return 1;
+	}
+
+	cout << argv[2] << ": " << GLYPH_COUNT << " glyphs, " << atlas.Width << "x" << atlas.Height << endl;
+	return 0;
+}
@@ -1,14 +1,25 @@
 #version 330 core
 
 // Interpolated values from the vertex shaders
-in vec3 fragColor;
+in vec2 texCoord;
+
+// signed distance to the glyph outline, 0.5 on the outline
+uniform sampler2D glyphAtlas;
+uniform vec3 fontColor;
 
 // output data
-out vec3 color;
+out vec4 color;
 
 void main()
 {
-    // Output color = color specified in the vertex shader,
-    // interpolated between all 3 surrounding vertices of the triangle
-    color = fragColor;
+    float distance = texture(glyphAtlas, texCoord).r;
+
+    // Fade out over about one pixel across the outline, whatever the zoom
+    float width = fwidth(distance);
+    float coverage = smoothstep(0.5 - width, 0.5 + width, distance);
+    if (coverage == 0.0)
+        discard;
+
+    // Premultiplied, like everything drawn into the cached layers
+    color = vec4(fontColor * coverage, coverage);
 }
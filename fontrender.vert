@@ -1,17 +1,29 @@
 #version 330 core
 
-uniform mat4 MVP;
-uniform vec3 pen;
-uniform vec3 fontColor;
+// input data : glyph quads of every string, laid out on the CPU
+layout (location = 0) in vec2 vertexPosition;
+layout (location = 1) in vec2 vertexTexCoord;
+layout (location = 2) in int vertexObject;
 
-in vec3 vertexPosition;
-in vec3 vertexNormal;
+// shared by every program, uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
 
-out vec3 fragColor;
+// model matrix columns then colour, 5 texels per object
+uniform samplerBuffer Objects;
+
+// output data : used by fragment shader
+out vec2 texCoord;
 
 void main ()
 {
-    gl_Position = MVP * (vec4(vertexPosition, 1.0) + vec4(pen, 1.0));
-    // fragColor = vec3((vertexNormal.x+1)/2,(vertexNormal.y+1)/2,(vertexNormal.z+1)/2);
-    fragColor = fontColor;
+    int object = vertexObject * 5;
+    mat4 model = mat4(texelFetch(Objects, object),
+                      texelFetch(Objects, object + 1),
+                      texelFetch(Objects, object + 2),
+                      texelFetch(Objects, object + 3));
+
+    texCoord = vertexTexCoord;
+    gl_Position = VP * model * vec4(vertexPosition, 0, 1);
 }
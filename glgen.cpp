@@ -0,0 +1,293 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <regex>
+#include <cctype>
+
+using namespace std;
+
+/* A GL function as declared in glcorearb.h */
+struct GLFunction {
+	string Name;
+	string Return;              // "void" for none
+	string Parameters;          // as declared, "void" for none
+	vector<string> Arguments;   // names of the parameters, to forward them
+};
+
+/* Read the function and extension names of a list, one per line, # starts a comment */
+bool readList (const char* path, vector<string>& functions, vector<string>& extensions)
+{
+	ifstream stream(path);
+	if (!stream.is_open())
+		return false;
+	string line;
+	while (getline(stream, line)) {
+		line = line.substr(0, line.find('#'));
+		istringstream words(line);
+		string word;
+		while (words >> word) {
+			if (word.compare(0, 3, "GL_") == 0)
+				extensions.push_back(word.substr(3));
+			else
+				functions.push_back(word);
+		}
+	}
+	return true;
+}
+
+/* Find the prototypes of glcorearb.h, written one per line as GLAPI type APIENTRY name (parameters); */
+bool readPrototypes (const char* path, map<string, GLFunction>& prototypes)
+{
+	ifstream stream(path);
+	if (!stream.is_open())
+		return false;
+	regex prototype("^GLAPI (.*)APIENTRY (gl[A-Za-z0-9_]+) \\((.*)\\);$");
+	regex argument("([A-Za-z0-9_]+)\\s*$");
+	string line;
+	smatch match;
+	while (getline(stream, line)) {
+		if (!regex_match(line, match, prototype))
+			continue;
+		GLFunction function;
+		function.Return = regex_replace(match[1].str(), regex("\\s+$"), "");
+		function.Name = match[2];
+		function.Parameters = match[3];
+		if (function.Parameters != "void") {
+			istringstream parameters(function.Parameters);
+			string parameter;
+			while (getline(parameters, parameter, ',')) {
+				smatch name;
+				if (regex_search(parameter, name, argument))
+					function.Arguments.push_back(name[1]);
+			}
+		}
+		prototypes[function.Name] = function;
+	}
+	return true;
+}
+
+/* PFNGLCLEARPROC for glClear */
+string pointerType (const string& name)
+{
+	string type = "PFNGL";
+	for (size_t i=2; i<name.size(); i++)
+		type += toupper(name[i]);
+	return type + "PROC";
+}
+
+void writeHeader (ostream& out, const vector<GLFunction>& functions, const vector<string>& extensions)
+{
+	out << "// Generated by glgen from glfunctions.txt, do not edit\n"
+	       "#ifndef GLLOADER_H\n"
+	       "#define GLLOADER_H\n"
+	       "\n"
+	       "#include <GL/glcorearb.h>\n"
+	       "\n"
+	       "typedef void (*GLProc) ();\n"
+	       "typedef GLProc (*GLLoadProc) (const char* name);\n"
+	       "\n"
+	       "/* Resolve the functions below through proc, all of them now or each one on its first call */\n"
+	       "/* The context must be current. Calling a function the driver lacks exits with its name */\n"
+	       "void loadGL (GLLoadProc proc, bool lazy);\n"
+	       "\n"
+	       "/* Extensions reported by the driver, set by loadGL */\n"
+	       "struct GLExtensionFlags {\n";
+	for (const string& extension : extensions)
+		out << "\tbool " << extension << ";\n";
+	out << "};\n"
+	       "extern GLExtensionFlags GLExtension;\n"
+	       "\n";
+	for (const GLFunction& function : functions)
+		out << "extern " << pointerType(function.Name) << " gll_" << function.Name << ";\n"
+		    << "#define " << function.Name << " gll_" << function.Name << "\n";
+	out << "\n"
+	       "#endif\n";
+}
+
+void writeSource (ostream& out, const vector<GLFunction>& functions, const vector<string>& extensions)
+{
+	out << "// Generated by glgen from glfunctions.txt, do not edit\n"
+	       "#include \"glloader.h\"\n"
+	       "#include <cstdio>\n"
+	       "#include <cstdlib>\n"
+	       "#include <cstring>\n"
+	       "\n"
+	       "GLExtensionFlags GLExtension;\n"
+	       "static GLLoadProc Loader;\n"
+	       "\n"
+	       "static GLProc resolve (const char* name)\n"
+	       "{\n"
+	       "\tGLProc function = Loader ? Loader(name) : NULL;\n"
+	       "\tif (!function) {\n"
+	       "\t\tfprintf(stderr, \"Error: GL function %s unavailable\\n\", name);\n"
+	       "\t\texit(EXIT_FAILURE);\n"
+	       "\t}\n"
+	       "\treturn function;\n"
+	       "}\n";
+
+	// Each pointer starts on a stub that resolves the function, stores it and forwards the call
+	for (const GLFunction& function : functions) {
+		string type = pointerType(function.Name), pointer = "gll_" + function.Name;
+		out << "\n"
+		    << "static " << function.Return << " APIENTRY lazy_" << function.Name << " (" << function.Parameters << ")\n"
+		    << "{\n"
+		    << "\t" << pointer << " = (" << type << ")resolve(\"" << function.Name << "\");\n"
+		    << "\t" << (function.Return == "void" ? "" : "return ") << pointer << " (";
+		for (size_t i=0; i<function.Arguments.size(); i++)
+			out << (i ? ", " : "") << function.Arguments[i];
+		out << ");\n"
+		    << "}\n"
+		    << type << " " << pointer << " = lazy_" << function.Name << ";\n";
+	}
+
+	out << "\n"
+	       "struct GLEntry {\n"
+	       "\tconst char* Name;\n"
+	       "\tGLProc* Pointer;\n"
+	       "};\n"
+	       "\n"
+	       "static const GLEntry Functions[] = {\n";
+	for (const GLFunction& function : functions)
+		out << "\t{\"" << function.Name << "\", (GLProc*)&gll_" << function.Name << "},\n";
+	out << "};\n"
+	       "\n"
+	       "void loadGL (GLLoadProc proc, bool lazy)\n"
+	       "{\n"
+	       "\tLoader = proc;\n"
+	       "\t// Functions the driver lacks keep their stub, which reports them if they are ever called\n"
+	       "\tif (!lazy)\n"
+	       "\t\tfor (const GLEntry& entry : Functions) {\n"
+	       "\t\t\tGLProc function = proc(entry.Name);\n"
+	       "\t\t\tif (function)\n"
+	       "\t\t\t\t*entry.Pointer = function;\n"
+	       "\t\t}\n"
+	       "\n"
+	       "\tmemset(&GLExtension, 0, sizeof(GLExtension));\n"
+	       "\tGLint count = 0;\n"
+	       "\tglGetIntegerv(GL_NUM_EXTENSIONS, &count);\n"
+	       "\tfor (GLint i=0; i<count; i++) {\n"
+	       "\t\tconst char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);\n";
+	for (const string& extension : extensions)
+		out << "\t\tif (strcmp(name, \"GL_" << extension << "\") == 0) GLExtension." << extension << " = true;\n";
+	out << "\t}\n"
+	       "}\n";
+}
+
+/* Blank out comments, strings and character literals, keeping the line breaks */
+string stripComments (const string& code)
+{
+	string out = code;
+	for (size_t i=0; i<out.size(); i++) {
+		if (out.compare(i, 2, "//") == 0) {
+			while (i < out.size() && out[i] != '\n')
+				out[i++] = ' ';
+		}
+		else if (out.compare(i, 2, "/*") == 0) {
+			size_t end = out.find("*/", i + 2);
+			end = end == string::npos ? out.size() : end + 2;
+			for (; i<end; i++)
+				if (out[i] != '\n')
+					out[i] = ' ';
+			i--;
+		}
+		else if (out[i] == '"' || out[i] == '\'') {
+			char quote = out[i++];
+			while (i < out.size() && out[i] != quote && out[i] != '\n') {
+				if (out[i] == '\\')
+					out[i++] = ' ';
+				out[i++] = ' ';
+			}
+		}
+	}
+	return out;
+}
+
+/* Report every call to a gl function missing from the list */
+bool checkSource (const char* path, const set<string>& listed)
+{
+	ifstream stream(path);
+	if (!stream.is_open()) {
+		cout << "Error: Could not read `" << path << "'" << endl;
+		return false;
+	}
+	stringstream buffer;
+	buffer << stream.rdbuf();
+	string code = stripComments(buffer.str());
+
+	bool valid = true;
+	int line = 1;
+	for (size_t i=0; i<code.size(); i++) {
+		if (code[i] == '\n')
+			line++;
+		if (code.compare(i, 2, "gl") != 0 || !isupper(code[i + 2]) || (i > 0 && (isalnum(code[i - 1]) || code[i - 1] == '_')))
+			continue;
+		size_t end = i;
+		while (end < code.size() && (isalnum(code[end]) || code[end] == '_'))
+			end++;
+		string name = code.substr(i, end - i);
+		if (!listed.count(name)) {
+			cout << path << ":" << line << ": error: " << name << " is not in glfunctions.txt, add it there to load it" << endl;
+			valid = false;
+		}
+		i = end - 1;
+	}
+	return valid;
+}
+
+/* Generate the GL loader for the functions of a list : glgen glfunctions.txt glcorearb.h glloader.h glloader.cpp */
+/* or check that sources call no other GL function : glgen --check glfunctions.txt source.cpp ... */
+int main (int argc, char** argv)
+{
+	bool check = argc >= 3 && string(argv[1]) == "--check";
+	if (!check && argc != 5) {
+		cout << "Usage: " << argv[0] << " glfunctions.txt glcorearb.h glloader.h glloader.cpp" << endl
+		     << "       " << argv[0] << " --check glfunctions.txt source.cpp ..." << endl;
+		return 1;
+	}
+
+	const char* list = argv[check ? 2 : 1];
+	vector<string> names, extensions;
+	if (!readList(list, names, extensions)) {
+		cout << "Error: Could not read `" << list << "'" << endl;
+		return 1;
+	}
+
+	if (check) {
+		set<string> listed(names.begin(), names.end());
+		bool valid = true;
+		for (int i=3; i<argc; i++)
+			valid = checkSource(argv[i], listed) && valid;
+		return valid ? 0 : 1;
+	}
+
+	map<string, GLFunction> prototypes;
+	if (!readPrototypes(argv[2], prototypes)) {
+		cout << "Error: Could not read `" << argv[2] << "'" << endl;
+		return 1;
+	}
+	vector<GLFunction> functions;
+	for (const string& name : names) {
+		if (!prototypes.count(name)) {
+			cout << "Error: " << name << " is not declared in `" << argv[2] << "'" << endl;
+			return 1;
+		}
+		functions.push_back(prototypes[name]);
+	}
+
+	ofstream header(argv[3]), source(argv[4]);
+	writeHeader(header, functions, extensions);
+	writeSource(source, functions, extensions);
+	header.close();
+	source.close();
+	if (!header || !source) {
+		cout << "Error: Could not write `" << argv[3] << "' and `" << argv[4] << "'" << endl;
+		return 1;
+	}
+
+	cout << argv[4] << ": " << functions.size() << " functions, " << extensions.size() << " extensions" << endl;
+	return 0;
+}
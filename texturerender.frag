@@ -0,0 +1,14 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec2 texCoord;
+
+uniform sampler2D layerTexture;
+
+// output data
+out vec4 color;
+
+void main()
+{
+    color = texture(layerTexture, texCoord);
+}
@@ -0,0 +1,19 @@
+#version 330 core
+
+// NDC depth of the layer : 1 behind everything, -1 in front of everything
+uniform float layerDepth;
+
+// Part of the texture holding the layer, when it was drawn smaller than the screen
+uniform vec2 layerScale;
+
+// output data : used by fragment shader
+out vec2 texCoord;
+
+void main ()
+{
+    // One triangle covering the whole screen, generated from the vertex index
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    texCoord = position*layerScale;
+
+    gl_Position = vec4(position*2.0 - 1.0, layerDepth, 1.0);
+}